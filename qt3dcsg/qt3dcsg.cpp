@@ -24,6 +24,8 @@
 #include <QFloat16>
 #include <QLoggingCategory>
 
+#include <unordered_map>
+
 #if QT_VERSION_MAJOR < 6
 #include <Qt3DRender/QAttribute>
 #include <Qt3DRender/QBuffer>
@@ -47,6 +49,7 @@ using QtCSG::Polygon;
 using QtCSG::Vertex;
 
 using QtCSG::Utils::reportError;
+using QtCSG::Utils::VertexHash;
 
 namespace {
 
@@ -297,7 +300,7 @@ Geometry::Geometry(QtCSG::Geometry csg, Qt3DCore::QNode *parent)
                     "Cannot create Qt3D geometry from QtCSG geometry with errors"))
         return;
 
-    const auto polygons = csg.polygons();
+    const auto &polygons = csg.polygons();
 
     if (polygons.isEmpty()) {
         qCWarning(lcGeometry, "Cannot create Qt3D geometry from empty QtCSG geometry");
@@ -318,34 +321,59 @@ Geometry::Geometry(QtCSG::Geometry csg, Qt3DCore::QNode *parent)
     });
 
     auto vertices = std::vector<Vertex>{};
+    auto vertexIndices = std::unordered_map<Vertex, uint, VertexHash>{};
     vertices.reserve(vertexCount);
+    vertexIndices.reserve(vertexCount);
 
-    using IndexType = ushort;
-    auto indices = std::vector<IndexType>{};
+    auto indices = std::vector<uint>{};
     indices.reserve(indexCount);
 
+    // Equal vertices are welded, so that vertices shared by polygons get uploaded only once.
+    const auto indexOf = [&vertices, &vertexIndices](const Vertex &vertex) {
+        const auto [it, inserted] = vertexIndices.try_emplace(vertex, static_cast<uint>(vertices.size()));
+
+        if (inserted)
+            vertices.emplace_back(vertex);
+
+        return it->second;
+    };
+
     for (const auto &p: polygons) {
-        const auto pv = p.vertices();
-        const auto i0 = static_cast<IndexType>(vertices.size());
+        const auto &pv = p.vertices();
 
-        Q_ASSERT(vertices.size() + pv.count() <= std::numeric_limits<IndexType>::max());
-        std::copy(pv.begin(), pv.end(), std::back_inserter(vertices));
+        if (Q_UNLIKELY(pv.count() < 3))
+            continue;
+
+        const auto i0 = indexOf(pv[0]);
+        auto previous = indexOf(pv[1]);
+
+        for (auto i = 2; i < pv.count(); ++i) {
+            const auto current = indexOf(pv[i]);
 
-        for (auto i = IndexType{2}; i < pv.count(); ++i) {
             indices.emplace_back(i0);
-            indices.emplace_back(i0 + i - 1);
-            indices.emplace_back(i0 + i);
+            indices.emplace_back(previous);
+            indices.emplace_back(current);
+
+            previous = current;
         }
     }
 
-    Q_ASSERT(vertices.size() == vertexCount);
+    Q_ASSERT(vertices.size() <= vertexCount);
     Q_ASSERT(indices.size() == indexCount);
 
     const auto vertexBuffer = new QBuffer{this};
     setData(vertexBuffer, vertices);
 
+    // Short indices are sufficient for most meshes, and they save memory on the GPU.
     const auto indexBuffer = new QBuffer{this};
-    setData(indexBuffer, indices);
+    auto indexType = QAttribute::UnsignedInt;
+
+    if (vertices.size() <= 1U + std::numeric_limits<ushort>::max()) {
+        setData(indexBuffer, std::vector<ushort>(indices.cbegin(), indices.cend()));
+        indexType = QAttribute::UnsignedShort;
+    } else {
+        setData(indexBuffer, indices);
+    }
 
     const auto positionAttribute = new QAttribute{this};
     const auto normalAttribute = new QAttribute{this};
@@ -372,7 +400,7 @@ Geometry::Geometry(QtCSG::Geometry csg, Qt3DCore::QNode *parent)
     indexAttribute->setBuffer(indexBuffer);
     indexAttribute->setAttributeType(QAttribute::IndexAttribute);
     indexAttribute->setCount(indices.size());
-    indexAttribute->setVertexBaseType(QAttribute::UnsignedShort);
+    indexAttribute->setVertexBaseType(indexType);
     addAttribute(indexAttribute);
 }
 
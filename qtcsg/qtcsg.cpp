@@ -17,19 +17,31 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 #include "qtcsg.h"
+#include "qtcsgexpression.h"
 #include "qtcsgmath.h"
+#include "qtcsgsimd.h"
 #include "qtcsgutils.h"
 
+#include <QCache>
 #include <QLoggingCategory>
+#include <QMutex>
 
-#include <QRegularExpression>
+#include <QVarLengthArray>
+#include <atomic>
+#include <algorithm>
 #include <cmath>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 namespace QtCSG {
 
 namespace {
 
-Q_LOGGING_CATEGORY(lcGeometry,  "qtcsg.geometry");
 Q_LOGGING_CATEGORY(lcNode,      "qtcsg.node");
 Q_LOGGING_CATEGORY(lcOperator,  "qtcsg.operator");
 
@@ -41,6 +53,616 @@ void flip(T &o)
     o.flip();
 }
 
+template<class T>
+T flipped(T o)
+{
+    o.flip();
+    return o;
+}
+
+void appendPolygons(QList<Polygon> *target, const QList<Polygon> &polygons, bool flipped)
+{
+    if (flipped)
+        std::transform(polygons.begin(), polygons.end(), std::back_inserter(*target), &QtCSG::flipped<Polygon>);
+    else
+        *target += polygons;
+}
+
+/// The payloads of the deprecated `Polygon::shared()` property. Equal payloads are
+/// stored once, and the payload at index `i` is referenced by attribute id `-1 - i`,
+/// which keeps them apart from the non-negative ids usually chosen by callers.
+class SharedValues
+{
+public:
+    static SharedValues &instance()
+    {
+        static auto sharedValues = SharedValues{};
+        return sharedValues;
+    }
+
+    int attribute(QVariant value)
+    {
+        if (value.isNull())
+            return 0;
+
+        const auto locker = QMutexLocker{&m_mutex};
+        auto index = m_values.indexOf(value);
+
+        if (index < 0) {
+            index = m_values.size();
+            m_values.append(std::move(value));
+            m_isUsed.store(true, std::memory_order_release);
+        }
+
+        return static_cast<int>(-1 - index);
+    }
+
+    QVariant value(int attribute)
+    {
+        if (attribute >= 0)
+            return {};
+
+        const auto locker = QMutexLocker{&m_mutex};
+        return m_values.value(-1 - attribute);
+    }
+
+    /// Returns the payloads of all deprecated `shared` values used by `polygons`.
+    Geometry::Attributes attributes(const QList<Polygon> &polygons)
+    {
+        auto attributes = Geometry::Attributes{};
+
+        if (!m_isUsed.load(std::memory_order_acquire))
+            return attributes;
+
+        const auto locker = QMutexLocker{&m_mutex};
+
+        for (const auto &polygon: polygons) {
+            if (const auto id = polygon.attribute(); id < 0 && !attributes.contains(id))
+                attributes.insert(id, m_values.value(-1 - id));
+        }
+
+        return attributes;
+    }
+
+private:
+    SharedValues() = default;
+
+    QMutex m_mutex;
+    QList<QVariant> m_values;
+    std::atomic<bool> m_isUsed = false;
+};
+
+using Simd::VertexType;
+using Simd::Coplanar;
+using Simd::Front;
+using Simd::Back;
+using Simd::Spanning;
+
+/// Orders positions lexicographically.
+bool isBefore(QVector3D a, QVector3D b)
+{
+    return std::make_tuple(a.x(), a.y(), a.z()) < std::make_tuple(b.x(), b.y(), b.z());
+}
+
+/// Classifies `position` relative to `plane`, without getting fooled by rounding errors
+/// of large coordinates: The distance is computed in single precision first, with an
+/// error bound that scales with the magnitude of the coordinates. Only if the result
+/// is too close to the tolerance to be trusted, it gets recomputed in double precision.
+VertexType classifyRobust(const Plane &plane, QVector3D position, float epsilon)
+{
+    const auto normal = plane.normal();
+    const auto magnitude = std::abs(normal.x() * position.x())
+            + std::abs(normal.y() * position.y())
+            + std::abs(normal.z() * position.z())
+            + std::abs(plane.w());
+
+    // Coordinates far away from the origin cannot be resolved any better than their
+    // own rounding error, which therefore also widens the coplanar tolerance.
+    const auto tolerance = std::max(epsilon, magnitude * 8 * std::numeric_limits<float>::epsilon());
+    const auto errorBound = magnitude * 4 * std::numeric_limits<float>::epsilon();
+    const auto t = dotProduct(normal, position) - plane.w();
+
+    if (t < -tolerance - errorBound)
+        return Back;
+    if (t > tolerance + errorBound)
+        return Front;
+    if (std::abs(t) < tolerance - errorBound)
+        return Coplanar;
+
+    const auto exact = static_cast<double>(normal.x()) * position.x()
+            + static_cast<double>(normal.y()) * position.y()
+            + static_cast<double>(normal.z()) * position.z()
+            - static_cast<double>(plane.w());
+
+    if (exact < -tolerance)
+        return Back;
+    if (exact > tolerance)
+        return Front;
+
+    return Coplanar;
+}
+
+/// Classifies `count` `vertices` relative to `plane` with the requested `precision`,
+/// and stores the type of each vertex in `types`. Returns the union of all types.
+VertexType classifyVertices(const Plane &plane, const Vertex *vertices, qsizetype count,
+                            float epsilon, Precision precision, VertexType *types)
+{
+    switch (precision) {
+    case Precision::Fast:
+        return Simd::classifyVertices(plane, vertices, count, epsilon, types);
+
+    case Precision::Robust:
+        break;
+    }
+
+    auto polygonType = Coplanar;
+
+    for (auto i = qsizetype{0}; i < count; ++i) {
+        types[i] = classifyRobust(plane, vertices[i].position(), epsilon);
+        polygonType = static_cast<VertexType>(polygonType | types[i]);
+    }
+
+    return polygonType;
+}
+
+VertexType classify(const Plane &plane, const Polygon &polygon, float epsilon)
+{
+    const auto &vertices = polygon.vertices();
+    auto vertexTypes = QVarLengthArray<VertexType, 16>(vertices.size());
+    return Simd::classifyVertices(plane, vertices.constData(), vertices.size(), epsilon, vertexTypes.data());
+}
+
+/// Picks the plane among a few candidate polygons that splits the fewest of
+/// some sampled polygons, while also keeping front and back sides balanced.
+/// Splits are weighted heavier since every split adds polygons to the tree.
+Plane findSampledCostPlane(const QList<Polygon> &polygons, float epsilon)
+{
+    constexpr auto candidateCount = 16;
+    constexpr auto sampleCount = 64;
+    constexpr auto splitWeight = 8;
+
+    const auto candidateStep = std::max<qsizetype>(1, polygons.size() / candidateCount);
+    const auto sampleStep = std::max<qsizetype>(1, polygons.size() / sampleCount);
+
+    auto bestPlane = polygons.first().plane();
+    auto bestCost = std::numeric_limits<qsizetype>::max();
+
+    for (auto i = qsizetype{0}; i < polygons.size() && bestCost > 0; i += candidateStep) {
+        const auto plane = polygons[i].plane();
+
+        if (plane.isNull())
+            continue;
+
+        auto front = qsizetype{0};
+        auto back = qsizetype{0};
+        auto spanning = qsizetype{0};
+
+        for (auto j = qsizetype{0}; j < polygons.size(); j += sampleStep) {
+            switch (classify(plane, polygons[j], epsilon)) {
+            case Coplanar:
+                break;
+            case Front:
+                ++front;
+                break;
+            case Back:
+                ++back;
+                break;
+            case Spanning:
+                ++spanning;
+                break;
+            }
+        }
+
+        if (const auto cost = splitWeight * spanning + std::abs(front - back); cost < bestCost) {
+            bestPlane = plane;
+            bestCost = cost;
+        }
+    }
+
+    return bestPlane;
+}
+
+/// Serializes access to a memory resource that's not thread-safe by itself.
+class SynchronizedResource : public std::pmr::memory_resource
+{
+public:
+    explicit SynchronizedResource(std::pmr::memory_resource *upstream)
+        : m_upstream{upstream}
+    {}
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        const auto locker = QMutexLocker{&m_mutex};
+        return m_upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        const auto locker = QMutexLocker{&m_mutex};
+        m_upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    QMutex m_mutex;
+    std::pmr::memory_resource *const m_upstream;
+};
+
+/// The arena from which all BSP nodes of a CSG operation are allocated.
+/// It grows on demand, and all its memory is released at once on destruction.
+class NodeArena
+{
+public:
+    NodeArena(const Geometry &lhs, const Geometry &rhs, const Options &options)
+        : NodeArena{lhs.polygons().count() + rhs.polygons().count(), options}
+    {}
+
+    NodeArena(qsizetype polygonCount, const Options &options)
+        : m_arena{estimateSize(polygonCount)}
+        , m_parallel{options.parallel}
+    {}
+
+    [[nodiscard]] std::pmr::memory_resource *resource()
+    {
+        if (m_parallel)
+            return &m_synchronized;
+
+        return &m_arena;
+    }
+
+private:
+    /// Guesses the size needed for the BSP trees built from `polygonCount` polygons.
+    /// This guess just avoids allocating too many small blocks.
+    static std::size_t estimateSize(qsizetype polygonCount)
+    {
+        constexpr auto estimatedNodeSize = sizeof(Node) + 4 * sizeof(void *); // control block
+        return std::max<std::size_t>(4096, 2 * static_cast<std::size_t>(polygonCount) * estimatedNodeSize);
+    }
+
+    std::pmr::monotonic_buffer_resource m_arena;
+    SynchronizedResource m_synchronized{&m_arena};
+    const bool m_parallel;
+};
+
+/// A BSP tree together with the arena its nodes are allocated from. This is how
+/// geometries cache their tree: Releasing it frees all of its nodes at once.
+struct ArenaTree
+{
+    ArenaTree(qsizetype polygonCount, const Options &options)
+        : arena{polygonCount, options}
+        , root{arena.resource()}
+    {}
+
+    NodeArena arena;
+    Node root; // must be destroyed before the arena
+};
+
+/// The polygons kept by the front side of the flat BSP tree node `entry`.
+struct KeptPolygons
+{
+    quint32 entry;
+    QList<Polygon> polygons;
+};
+
+/// Splits `polygons` by `plane`. If `flipped` is set, the polygons are treated
+/// as if they were flipped, which only matters if they are coplanar with `plane`.
+void splitAll(const QList<Polygon> &polygons, const Plane &plane, bool flipped,
+              float epsilon, Precision precision,
+              QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
+              QList<Polygon> *front, QList<Polygon> *back)
+{
+    if (flipped)
+        Polygon::splitAll(polygons, plane, coplanarBack, coplanarFront, front, back, epsilon, precision);
+    else
+        Polygon::splitAll(polygons, plane, coplanarFront, coplanarBack, front, back, epsilon, precision);
+}
+
+/// Clips `polygons` against a flat BSP tree, and reports the polygons kept by
+/// each node. The nodes are reported in pre-order, just like they are stored.
+/// If `flipped` is set, the polygons are treated as if they were flipped.
+std::vector<KeptPolygons> clipPolygonBatch(const QVector<FlatTree::Entry> &entries,
+                                           const QVector<Plane> &planes,
+                                           QList<Polygon> polygons, bool flipped,
+                                           float epsilon, Precision precision)
+{
+    struct Task
+    {
+        quint32 parent;
+        quint32 index;              // the polygons are kept if this is NoChild
+        QList<Polygon> polygons;
+    };
+
+    auto result = std::vector<KeptPolygons>{};
+    auto pending = std::vector<Task>{};
+    pending.push_back({FlatTree::NoChild, 0, std::move(polygons)});
+
+    // Front fragments are pushed last, so that they get processed first,
+    // which reproduces the order of csg.js' recursive implementation.
+    while (!pending.empty()) {
+        auto task = std::move(pending.back());
+        pending.pop_back();
+
+        if (task.index == FlatTree::NoChild) {
+            result.push_back({task.parent, std::move(task.polygons)});
+            continue;
+        }
+
+        const auto &entry = entries[task.index];
+        const auto &plane = planes[task.index];
+
+        // Like Node::clipPolygons(), nodes without a plane keep all polygons.
+        if (plane.isNull()) {
+            result.push_back({task.index, std::move(task.polygons)});
+            continue;
+        }
+
+        auto front = QList<Polygon>{};
+        auto back = QList<Polygon>{};
+
+        splitAll(task.polygons, plane, flipped, epsilon, precision, &front, &back, &front, &back);
+
+        if (entry.back != FlatTree::NoChild && !back.isEmpty())
+            pending.push_back({task.index, entry.back, std::move(back)});
+        if (!front.isEmpty())
+            pending.push_back({task.index, entry.front, std::move(front)});
+    }
+
+    return result;
+}
+
+/// Turns a relative tolerance of `options` into an absolute one, by scaling it with
+/// the diagonal of `bounds`. Absolute tolerances are returned unchanged.
+Options withAbsoluteTolerance(Options options, const BoundingBox &bounds)
+{
+    if (options.toleranceMode == ToleranceMode::Relative) {
+        if (!bounds.isNull())
+            options.tolerance *= (bounds.maximum() - bounds.minimum()).length();
+
+        options.toleranceMode = ToleranceMode::Absolute;
+    }
+
+    return options;
+}
+
+/// Copies the BSP tree of `geometry` into `node`, with its nodes allocated
+/// from `resource`. The tree is built and cached by `geometry` if needed.
+Error copyTree(const Geometry &geometry, const Options &options,
+               std::pmr::memory_resource *resource, Node *node)
+{
+    const auto tree = geometry.tree(options);
+
+    if (const auto error = std::get_if<Error>(&tree))
+        return *error;
+
+    *node = std::get<std::shared_ptr<const Node>>(tree)->cloned(resource);
+    return Error::NoError;
+}
+
+/// Tells if bounding boxes can decide which parts of `lhs` and `rhs` are outside
+/// of each other. This needs both operands to be bounded.
+bool canCullByBounds(const Geometry &lhs, const Geometry &rhs)
+{
+    return lhs.isBounded() && rhs.isBounded();
+}
+
+/// The operand of a CSG operation with overlap culling. Only the `nearby`
+/// polygons, which might touch the other operand, need clipping. All other
+/// polygons are `distant` from the other operand, and are entirely outside.
+struct CulledOperand
+{
+    std::shared_ptr<const Node> tree;
+    QList<Polygon> nearby;
+    QList<Polygon> distant;
+};
+
+/// Splits the polygons of `lhs` and `rhs` by the overlap of their bounding
+/// boxes, and fetches their BSP trees for clipping the nearby polygons.
+Error cullOperands(const Geometry &lhs, const Geometry &rhs, const Options &options,
+                   CulledOperand *a, CulledOperand *b)
+{
+    const auto overlap = lhs.boundingBox().intersected(rhs.boundingBox(), options.tolerance);
+
+    const auto partition = [&overlap, &options](const Geometry &geometry, CulledOperand *operand) {
+        for (const auto &polygon: geometry.polygons()) {
+            if (BoundingBox::fromPolygon(polygon).intersects(overlap, options.tolerance))
+                operand->nearby.append(polygon);
+            else
+                operand->distant.append(polygon);
+        }
+    };
+
+    partition(lhs, a);
+    partition(rhs, b);
+
+    const auto fetchTree = [&options](const Geometry &geometry, CulledOperand *operand) {
+        auto tree = geometry.tree(options);
+
+        if (const auto error = std::get_if<Error>(&tree))
+            return *error;
+
+        operand->tree = std::get<std::shared_ptr<const Node>>(std::move(tree));
+        return Error::NoError;
+    };
+
+    if (const auto error = fetchTree(lhs, a);
+        reportError(lcOperator(), error, "Could not build BSP tree from lhs geometry"))
+        return error;
+    if (const auto error = fetchTree(rhs, b);
+        reportError(lcOperator(), error, "Could not build BSP tree from rhs geometry"))
+        return error;
+
+    return Error::NoError;
+}
+
+enum class Side
+{
+    Lhs,
+    Rhs,
+};
+
+/// Tells if `operation` keeps the polygons of the `side` operand, which are
+/// distant from the other operand, and therefore entirely outside of it.
+bool keepsDistant(Operation operation, Side side)
+{
+    switch (operation) {
+    case Operation::Merge:
+        return true;
+    case Operation::Subtract:
+        return side == Side::Lhs;
+    case Operation::Intersect:
+        return false;
+    }
+
+    return false;
+}
+
+/// Clips the polygons of the `side` operand, which are near the other operand,
+/// against the BSP tree of the other operand, or against its inverse. These are
+/// the operators of csg.js, rewritten for polygon lists. Clipping flipped polygons,
+/// which then get flipped back, is done by clipping unflipped polygons in flipped
+/// mode, which avoids all of these flips.
+QList<Polygon> clipNearby(Operation operation, Side side, QList<Polygon> nearby,
+                          const Node &other, const Node &inverseOther)
+{
+    switch (operation) {
+    case Operation::Merge:
+        if (side == Side::Lhs)
+            return other.clipPolygons(std::move(nearby));
+
+        return other.clipPolygons(other.clipPolygons(std::move(nearby)), true);
+
+    case Operation::Subtract:
+        if (side == Side::Lhs)
+            return other.clipPolygons(std::move(nearby), true);
+
+        nearby = inverseOther.clipPolygons(std::move(nearby));
+        std::for_each(nearby.begin(), nearby.end(), &flip<Polygon>);
+        return inverseOther.clipPolygons(std::move(nearby));
+
+    case Operation::Intersect:
+        if (side == Side::Lhs)
+            return inverseOther.clipPolygons(std::move(nearby), true);
+
+        return inverseOther.clipPolygons(inverseOther.clipPolygons(std::move(nearby)), true);
+    }
+
+    return {};
+}
+
+QList<Polygon> operateCulled(Operation operation, const CulledOperand &a, const CulledOperand &b)
+{
+    auto polygons = QList<Polygon>{};
+
+    if (keepsDistant(operation, Side::Lhs))
+        polygons += a.distant;
+    if (keepsDistant(operation, Side::Rhs))
+        polygons += b.distant;
+
+    polygons += clipNearby(operation, Side::Lhs, a.nearby, *b.tree, b.tree->inverted());
+    polygons += clipNearby(operation, Side::Rhs, b.nearby, *a.tree, a.tree->inverted());
+
+    return polygons;
+}
+
+/// Combines `geometries` pairwise in rounds, so that the operands of each
+/// `operation` have similar complexity, instead of growing one operand with
+/// each step. The pairs of each round are independent, and run concurrently.
+template<typename BinaryOp>
+Geometry reduce(QList<Geometry> geometries, Options options, BinaryOp operation)
+{
+    for (const auto &geometry: geometries) {
+        if (reportError(lcOperator(), geometry.error(), "Invalid geometry"))
+            return Geometry{geometry.error()};
+    }
+
+    // Resolve a relative tolerance once, so that all pairs use the same tolerance.
+    const auto bounds = std::accumulate(geometries.cbegin(), geometries.cend(), BoundingBox{},
+                                        [](const BoundingBox &box, const Geometry &geometry) {
+        return box.united(geometry.boundingBox());
+    });
+
+    options = withAbsoluteTolerance(std::move(options), bounds);
+
+    auto operands = std::vector<Geometry>{geometries.begin(), geometries.end()};
+
+    while (operands.size() > 1) {
+        auto results = std::vector<Geometry>((operands.size() + 1) / 2);
+        auto tasks = Utils::TaskGroup{};
+
+        for (auto i = std::size_t{0}; i + 1 < operands.size(); i += 2) {
+            tasks.run([&operands, &results, &options, &operation, i] {
+                results[i / 2] = operation(operands[i], operands[i + 1], options);
+            });
+        }
+
+        if (operands.size() % 2)
+            results.back() = operands.back();
+
+        tasks.wait();
+        operands = std::move(results);
+    }
+
+    if (operands.empty())
+        return Geometry{};
+
+    return operands.front();
+}
+
+/// Creates the result of an operation on `lhs` and `rhs` from `polygons`,
+/// and keeps the attribute payloads of both operands.
+Geometry makeResult(QList<Polygon> polygons, const Geometry &lhs, const Geometry &rhs)
+{
+    auto attributes = rhs.attributes();
+    attributes.insert(lhs.attributes());
+    return Geometry{std::move(polygons), std::move(attributes)};
+}
+
+Plane findSplitPlane(const QList<Polygon> &polygons, SplitStrategy strategy, float epsilon)
+{
+    switch (strategy) {
+    case SplitStrategy::FirstPolygon:
+        break;
+
+    case SplitStrategy::SampledCost:
+        return findSampledCostPlane(polygons, epsilon);
+    }
+
+    return polygons.first().plane();
+}
+
+/// Returns the cofactor matrix of the linear part of `matrix`, which transforms plane
+/// normals. Other than the inverse transpose it keeps the orientation of mirrored
+/// planes consistent with `Plane::fromPoints()`, and needs no division.
+QMatrix4x4 cofactorMatrix(const QMatrix4x4 &matrix)
+{
+    const auto x = QVector3D{matrix(0, 0), matrix(1, 0), matrix(2, 0)};
+    const auto y = QVector3D{matrix(0, 1), matrix(1, 1), matrix(2, 1)};
+    const auto z = QVector3D{matrix(0, 2), matrix(1, 2), matrix(2, 2)};
+
+    const auto yz = crossProduct(y, z);
+    const auto zx = crossProduct(z, x);
+    const auto xy = crossProduct(x, y);
+
+    return {
+        yz.x(), zx.x(), xy.x(), 0,
+        yz.y(), zx.y(), xy.y(), 0,
+        yz.z(), zx.z(), xy.z(), 0,
+             0,      0,      0, 1,
+    };
+}
+
+/// Transforms `plane` by the `cofactors` of some matrix, which also mapped one
+/// of the plane's points to `point`.
+Plane transformedPlane(const Plane &plane, const QMatrix4x4 &cofactors, QVector3D point)
+{
+    const auto normal = (cofactors * plane.normal()).normalized();
+    return Plane{normal, dotProduct(normal, point)};
+}
+
 } // namespace
 
 void Vertex::flip()
@@ -75,6 +697,16 @@ void Plane::flip()
     m_w = -m_w;
 }
 
+int Polygon::sharedAttribute(QVariant shared)
+{
+    return SharedValues::instance().attribute(std::move(shared));
+}
+
+QVariant Polygon::sharedValue(int attribute)
+{
+    return SharedValues::instance().value(attribute);
+}
+
 void Polygon::flip()
 {
     std::reverse(m_vertices.begin(), m_vertices.end());
@@ -84,42 +716,90 @@ void Polygon::flip()
 
 Polygon Polygon::transformed(const QMatrix4x4 &matrix) const
 {
-    auto transformed = QList<Vertex>{};
-    transformed.reserve(m_vertices.count());
+    return transformed(matrix, findRotation(matrix), cofactorMatrix(matrix));
+}
+
+Polygon Polygon::transformed(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                             const QMatrix4x4 &cofactors) const
+{
+    if (m_vertices.isEmpty())
+        return *this;
 
-    const auto applyMatrix = [matrix](const Vertex &vertex) {
-        return vertex.transformed(matrix);
-    };
+    auto transformed = VertexList(m_vertices.size());
+    Simd::transformVertices(matrix, rotation, m_vertices.constData(), m_vertices.size(),
+                            transformed.data());
 
-    std::transform(m_vertices.cbegin(), m_vertices.cend(),
-                   std::back_inserter(transformed), applyMatrix);
+    // Perspective divisions don't map planes linearly.
+    if (!isAffine(matrix))
+        return Polygon{std::move(transformed), m_attribute};
 
-    return Polygon{std::move(transformed)};
+    auto plane = transformedPlane(m_plane, cofactors, transformed.first().position());
+    return Polygon{std::move(transformed), m_attribute, std::move(plane)};
 }
 
 void Polygon::split(const Plane &plane,
                     QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
-                    QList<Polygon> *front, QList<Polygon> *back, float epsilon) const
+                    QList<Polygon> *front, QList<Polygon> *back,
+                    float epsilon, Precision precision) const
 {
-    enum VertexType {
-        Coplanar = 0,
-        Front = (1 << 0),
-        Back = (1 << 1),
-        Spanning = Front | Back
-    };
-
     // Classify each point as well as the entire polygon into one of the above four classes.
-    auto polygonType = Coplanar;
-    auto vertexTypes = std::vector<VertexType>{};
-    vertexTypes.reserve(m_vertices.size());
+    // Polygons rarely have many vertices, so that the types usually fit into the stack.
+    auto vertexTypes = QVarLengthArray<VertexType, 16>(m_vertices.size());
+    const auto polygonType = classifyVertices(plane, m_vertices.constData(), m_vertices.size(),
+                                              epsilon, precision, vertexTypes.data());
+
+    split(plane, vertexTypes.constData(), polygonType, coplanarFront, coplanarBack, front, back);
+}
+
+void Polygon::splitAll(const QList<Polygon> &polygons, const Plane &plane,
+                       QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
+                       QList<Polygon> *front, QList<Polygon> *back,
+                       float epsilon, Precision precision)
+{
+    // Robust classification has no SIMD kernels that would benefit from batching.
+    if (precision != Precision::Fast) {
+        for (const auto &polygon: polygons)
+            polygon.split(plane, coplanarFront, coplanarBack, front, back, epsilon, precision);
+
+        return;
+    }
+
+    // Triangles and quads don't even fill the lanes of the wider kernels. Therefore the
+    // vertices of all polygons are classified at once. Only pointers to the vertices
+    // get collected, copying the vertices themselves would cost more than it saves.
+    auto vertexCount = qsizetype{0};
+
+    for (const auto &polygon: polygons)
+        vertexCount += polygon.m_vertices.size();
+
+    auto vertices = QVarLengthArray<const Vertex *, 64>(vertexCount);
+    auto nextVertex = vertices.data();
+
+    for (const auto &polygon: polygons) {
+        for (const auto &vertex: polygon.m_vertices)
+            *nextVertex++ = &vertex;
+    }
 
-    for (const auto &v: m_vertices) {
-        const auto t = dotProduct(plane.normal(), v.position()) - plane.w();
-        const auto type = (t < -epsilon) ? Back : (t > epsilon) ? Front : Coplanar;
-        polygonType = static_cast<VertexType>(polygonType | type);
-        vertexTypes.emplace_back(type);
+    auto vertexTypes = QVarLengthArray<VertexType, 64>(vertexCount);
+    Simd::classifyVertices(plane, vertices.constData(), vertexCount, epsilon, vertexTypes.data());
+
+    auto types = vertexTypes.constData();
+
+    for (const auto &polygon: polygons) {
+        const auto count = polygon.m_vertices.size();
+        const auto polygonType = std::accumulate(types, types + count, Coplanar, [](auto lhs, auto rhs) {
+            return static_cast<VertexType>(lhs | rhs);
+        });
+
+        polygon.split(plane, types, polygonType, coplanarFront, coplanarBack, front, back);
+        types += count;
     }
+}
 
+void Polygon::split(const Plane &plane, const VertexType *vertexTypes, VertexType polygonType,
+                    QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
+                    QList<Polygon> *front, QList<Polygon> *back) const
+{
     // Put the polygon in the correct list, splitting it when necessary.
     switch (polygonType) {
     case Coplanar:
@@ -139,16 +819,32 @@ void Polygon::split(const Plane &plane,
         break;
 
     case Spanning:
-        auto f = QList<Vertex>{};
-        auto b = QList<Vertex>{};
+        // Count the vertices of both fragments first, so that they get allocated with their
+        // exact size: Vertices in front go to the front fragment, vertices behind to the back
+        // fragment, coplanar ones to both. Each edge crossing the plane adds a vertex to both.
+        auto frontCount = qsizetype{0};
+        auto backCount = qsizetype{0};
+
+        for (auto i = 0; i < m_vertices.count(); ++i) {
+            const auto ti = vertexTypes[i];
+            const auto crossing = (ti | vertexTypes[(i + 1) % m_vertices.count()]) == Spanning;
+
+            frontCount += (ti != Back) + crossing;
+            backCount += (ti != Front) + crossing;
+        }
+
+        auto f = VertexList{};
+        auto b = VertexList{};
+        f.reserve(frontCount);
+        b.reserve(backCount);
 
         for (auto i = 0; i < m_vertices.count(); ++i) {
               const auto j = (i + 1) % m_vertices.count();
 
               const auto ti = vertexTypes[i];
               const auto tj = vertexTypes[j];
-              const auto vi = m_vertices[i];
-              const auto vj = m_vertices[j];
+              const auto &vi = m_vertices[i];
+              const auto &vj = m_vertices[j];
 
               if (ti != Back)
                   f.append(vi);
@@ -156,261 +852,443 @@ void Polygon::split(const Plane &plane,
                   b.append(vi);
 
               if ((ti | tj) == Spanning) {
+                  // Always walk the edge in the same direction. The neighbour sharing
+                  // this edge walks it the other way, but must create the very same
+                  // vertex, so that the edge stays closed, and the vertex can be welded.
+                  const auto &[va, vb] = isBefore(vi.position(), vj.position())
+                          ? std::tie(vi, vj) : std::tie(vj, vi);
+
                   const auto t = (plane.w()
-                                  - dotProduct(plane.normal(), vi.position()))
-                                  / dotProduct(plane.normal(), vj.position() - vi.position());
-                  const auto v = vi.interpolated(vj, t);
+                                  - dotProduct(plane.normal(), va.position()))
+                                  / dotProduct(plane.normal(), vb.position() - va.position());
+                  const auto v = va.interpolated(vb, t);
 
                   f.append(v);
                   b.append(v);
               }
         }
 
+        // The fragments lie in the plane of this polygon, no need to compute it again.
         if (f.count() >= 3)
-            front->append(Polygon{std::move(f), m_shared});
+            front->append(Polygon{std::move(f), m_attribute, m_plane});
         if (b.count() >= 3)
-            back->append(Polygon{std::move(b), m_shared});
+            back->append(Polygon{std::move(b), m_attribute, m_plane});
 
         break;
     }
 }
 
-Geometry Geometry::inversed() const
+BoundingBox BoundingBox::fromPolygons(const QList<Polygon> &polygons)
 {
-    auto inverse = QList<Polygon>{};
-    inverse.reserve(m_polygons.size());
-    std::copy(m_polygons.begin(), m_polygons.end(), std::back_inserter(inverse));
-    std::for_each(inverse.begin(), inverse.end(), &flip<Polygon>);
-    return Geometry{std::move(inverse)};
+    auto box = BoundingBox{};
+
+    for (const auto &polygon: polygons) {
+        for (const auto &vertex: polygon.vertices())
+            box.extend(vertex.position());
+    }
+
+    return box;
 }
 
-Geometry Geometry::transformed(const QMatrix4x4 &matrix) const
+BoundingBox BoundingBox::fromPolygon(const Polygon &polygon)
 {
-    auto transformed = QList<Polygon>{};
-    transformed.reserve(m_polygons.count());
+    const auto &vertices = polygon.vertices();
+    return fromVertices({vertices.constData(), static_cast<std::size_t>(vertices.size())});
+}
 
-    const auto applyMatrix = [matrix](const Polygon &polygon) {
-        return polygon.transformed(matrix);
-    };
+BoundingBox BoundingBox::fromVertices(std::span<const Vertex> vertices)
+{
+    auto box = BoundingBox{};
 
-    std::transform(m_polygons.cbegin(), m_polygons.cend(),
-                   std::back_inserter(transformed), applyMatrix);
+    for (const auto &vertex: vertices)
+        box.extend(vertex.position());
 
-    return Geometry{std::move(transformed)};
+    return box;
 }
 
-namespace {
+void BoundingBox::extend(QVector3D point)
+{
+    if (m_isNull) {
+        m_minimum = m_maximum = point;
+        m_isNull = false;
+        return;
+    }
+
+    m_minimum = QVector3D{std::min(m_minimum.x(), point.x()),
+                          std::min(m_minimum.y(), point.y()),
+                          std::min(m_minimum.z(), point.z())};
+    m_maximum = QVector3D{std::max(m_maximum.x(), point.x()),
+                          std::max(m_maximum.y(), point.y()),
+                          std::max(m_maximum.z(), point.z())};
+}
 
-struct EnsureValue
+bool BoundingBox::intersects(const BoundingBox &other, float epsilon) const
 {
-    const QVariantMap &arguments;
+    if (isNull() || other.isNull())
+        return false;
 
-    template<typename T>
-    T operator()(const QString &key, T defaultValue = {}) const
-    {
-        return (*this)(arguments.constFind(key), std::move(defaultValue));
-    }
+    return m_minimum.x() <= other.m_maximum.x() + epsilon && other.m_minimum.x() <= m_maximum.x() + epsilon
+        && m_minimum.y() <= other.m_maximum.y() + epsilon && other.m_minimum.y() <= m_maximum.y() + epsilon
+        && m_minimum.z() <= other.m_maximum.z() + epsilon && other.m_minimum.z() <= m_maximum.z() + epsilon;
+}
 
-    template<typename T>
-    T operator()(const QVariantMap::ConstIterator &iter, T defaultValue = {}) const
-    {
-        if (iter != arguments.constEnd())
-            return qvariant_cast<T>(*iter);
+BoundingBox BoundingBox::intersected(const BoundingBox &other, float epsilon) const
+{
+    if (!intersects(other, epsilon))
+        return {};
 
-        return defaultValue;
-    }
+    const auto grow = QVector3D{epsilon, epsilon, epsilon};
+
+    return {QVector3D{std::max(m_minimum.x(), other.m_minimum.x()),
+                      std::max(m_minimum.y(), other.m_minimum.y()),
+                      std::max(m_minimum.z(), other.m_minimum.z())} - grow,
+            QVector3D{std::min(m_maximum.x(), other.m_maximum.x()),
+                      std::min(m_maximum.y(), other.m_maximum.y()),
+                      std::min(m_maximum.z(), other.m_maximum.z())} + grow};
+}
+
+BoundingBox BoundingBox::united(const BoundingBox &other) const
+{
+    if (other.isNull())
+        return *this;
+    if (isNull())
+        return other;
+
+    auto box = *this;
+    box.extend(other.m_minimum);
+    box.extend(other.m_maximum);
+    return box;
+}
+
+struct Geometry::Cache
+{
+    std::once_flag transformed;
+    QList<Polygon> transformedPolygons;
+    std::shared_ptr<Cache> source;      // of the polygons without pending transform
+
+    QMutex mutex;
+    std::optional<BoundingBox> boundingBox;
+    std::optional<bool> bounded;
+    std::shared_ptr<const Node> tree;
+    int limit = defaultRecursionLimit();
+    SplitStrategy splitStrategy = SplitStrategy::FirstPolygon;
+    Precision precision = Precision::Fast;
+    float tolerance = defaultTolerance();
+    ToleranceMode toleranceMode = ToleranceMode::Absolute;
 };
 
-Geometry createGeometry(QStringView primitiveName, QVariantMap arguments)
+Geometry::Geometry(Error error)
+    : m_error{error}
+    , m_cache{std::make_shared<Cache>()}
+{}
+
+Geometry::Geometry(QList<Polygon> polygons, Error error)
+    : m_polygons{std::move(polygons)}
+    , m_attributes{SharedValues::instance().attributes(m_polygons)}
+    , m_error{error}
+    , m_cache{std::make_shared<Cache>()}
+{}
+
+Geometry::Geometry(QList<Polygon> polygons, Attributes attributes, Error error)
+    : m_polygons{std::move(polygons)}
+    , m_attributes{std::move(attributes)}
+    , m_error{error}
+    , m_cache{std::make_shared<Cache>()}
+{}
+
+const QList<Polygon> &Geometry::polygons() const &
 {
-    const auto value = EnsureValue{arguments};
+    if (!m_transform)
+        return m_polygons;
 
-    if (primitiveName == u"cube") {
-        const auto radius = arguments.value("r", 1.0f);
+    std::call_once(m_cache->transformed, [this] {
+        const auto &matrix = *m_transform;
+        const auto rotation = findRotation(matrix);
+        const auto cofactors = cofactorMatrix(matrix);
 
-        if (radius.userType() == qMetaTypeId<QVector3D>()) {
-            return cube(value("center", QVector3D{}),
-                        qvariant_cast<QVector3D>(radius));
-        }
+        auto &transformed = m_cache->transformedPolygons;
+        transformed.reserve(m_polygons.count());
 
-        return cube(value("center", QVector3D{}), radius.toFloat());
-    }
+        const auto applyMatrix = [&matrix, &rotation, &cofactors](const Polygon &polygon) {
+            return polygon.transformed(matrix, rotation, cofactors);
+        };
 
-    if (primitiveName == u"cylinder") {
-        const auto start = arguments.constFind("start");
-        const auto end = arguments.constFind("end");
+        std::transform(m_polygons.cbegin(), m_polygons.cend(),
+                       std::back_inserter(transformed), applyMatrix);
+    });
 
-        if (start != arguments.constEnd() || end != arguments.constEnd()) {
-            static const auto conflicts = std::array<QString, 2>{"center", "h"};
+    return m_cache->transformedPolygons;
+}
 
-            for (const auto &conflictingName: conflicts) {
-                if (arguments.contains(conflictingName)) {
-                    qCWarning(lcGeometry,
-                              R"(Argument "%ls" conflicts with arguments )"
-                              R"("start" and "end" of %ls primitive)",
-                              qUtf16Printable(conflictingName),
-                              qUtf16Printable(primitiveName.toString()));
+QList<Polygon> Geometry::polygons() &&
+{
+    return takePolygons();
+}
 
-                    return Geometry{Error::FileFormatError};
-                }
-            }
+QList<Polygon> Geometry::takePolygons()
+{
+    auto polygons = m_transform ? std::as_const(*this).polygons() : std::exchange(m_polygons, {});
 
-            return cylinder(value(start,    QVector3D{}),
-                            value(end,      QVector3D{}),
-                            value("r",      1.0f),
-                            value("slices", 16));
-        } else {
-            return cylinder(value("center", QVector3D{}),
-                            value("h",      2.0f),
-                            value("r",      1.0f),
-                            value("slices", 16));
+    // Other copies of this geometry still have their polygons, and need the cache.
+    m_cache = std::make_shared<Cache>();
+    m_transform.reset();
+    m_polygons = {};
+
+    return polygons;
+}
+
+BoundingBox Geometry::boundingBox() const
+{
+    const auto locker = QMutexLocker{&m_cache->mutex};
+
+    if (!m_cache->boundingBox)
+        m_cache->boundingBox = BoundingBox::fromPolygons(polygons());
+
+    return *m_cache->boundingBox;
+}
+
+bool Geometry::isBounded() const
+{
+    const auto locker = QMutexLocker{&m_cache->mutex};
+
+    if (!m_cache->bounded) {
+        auto volume = 0.0;
+
+        for (const auto &polygon: polygons()) {
+            const auto &vertices = polygon.vertices();
+
+            for (auto i = 2; i < vertices.size(); ++i) {
+                volume += dotProduct(vertices[0].position(),
+                                     crossProduct(vertices[i - 1].position(),
+                                                  vertices[i].position()));
+            }
         }
+
+        m_cache->bounded = (volume >= 0);
     }
 
-    if (primitiveName == u"sphere") {
-        return sphere(value("center",   QVector3D{}),
-                      value("r",        1.0f),
-                      value("slices",   16),
-                      value("stacks",   8));
+    return *m_cache->bounded;
+}
+
+std::variant<std::shared_ptr<const Node>, Error> Geometry::tree(const Options &options) const
+{
+    const auto locker = QMutexLocker{&m_cache->mutex};
+
+    if (m_cache->tree
+            && m_cache->limit == options.limit
+            && m_cache->splitStrategy == options.splitStrategy
+            && m_cache->precision == options.precision
+            && m_cache->tolerance == options.tolerance
+            && m_cache->toleranceMode == options.toleranceMode)
+        return m_cache->tree;
+
+    // Instances of the same polygons share the tree built for these polygons,
+    // if their transform keeps its partitions. Only its copy gets transformed.
+    if (m_transform && m_cache->source
+            && options.toleranceMode == ToleranceMode::Absolute
+            && isSimilarity(*m_transform)) {
+        auto source = Geometry{m_polygons, m_attributes};
+        source.m_cache = m_cache->source;
+
+        auto sourceOptions = options;
+        sourceOptions.tolerance /= findScale(*m_transform).x();
+
+        const auto sourceTree = source.tree(sourceOptions);
+
+        if (const auto error = std::get_if<Error>(&sourceTree))
+            return *error;
+
+        const auto &tree = std::get<std::shared_ptr<const Node>>(sourceTree);
+        const auto arenaTree = std::make_shared<ArenaTree>(m_polygons.count(), options);
+        arenaTree->root = tree->transformed(*m_transform, arenaTree->arena.resource());
+        m_cache->tree = std::shared_ptr<const Node>{arenaTree, &arenaTree->root};
+    } else {
+        const auto arenaTree = std::make_shared<ArenaTree>(polygons().count(), options);
+
+        if (const auto error = arenaTree->root.build(polygons(), options);
+            reportError(lcNode(), error, "Could not build BSP tree from polygons"))
+            return error;
+
+        m_cache->tree = std::shared_ptr<const Node>{arenaTree, &arenaTree->root};
     }
 
-    qCCritical(lcGeometry, R"(Unsupported primitive type: "%ls")",
-               qUtf16Printable(primitiveName.toString()));
+    m_cache->limit = options.limit;
+    m_cache->splitStrategy = options.splitStrategy;
+    m_cache->precision = options.precision;
+    m_cache->tolerance = options.tolerance;
+    m_cache->toleranceMode = options.toleranceMode;
 
-    return Geometry{Error::FileFormatError};
+    return m_cache->tree;
 }
 
-using ArgumentTypeMap = QMap<QString, QList<int>>;
-
-QVariant parseArgument(const QString &primitive,
-                       const QString &argName,
-                       const QRegularExpressionMatch &match,
-                       const ArgumentTypeMap &argTypeMap)
+Geometry Geometry::inversed() const
 {
-    const auto valueSpec = argTypeMap.constFind(argName);
+    const auto &polygons = this->polygons();
 
-    if (valueSpec == argTypeMap.constEnd()) {
-        qCWarning(lcGeometry, R"(Unsupported argument "%ls" for %ls primitive)",
-                  qUtf16Printable(argName), qUtf16Printable(primitive));
-        return {};
-    }
+    auto inverse = QList<Polygon>{};
+    inverse.reserve(polygons.size());
+    std::copy(polygons.begin(), polygons.end(), std::back_inserter(inverse));
+    std::for_each(inverse.begin(), inverse.end(), &flip<Polygon>);
+    return Geometry{std::move(inverse), m_attributes};
+}
 
-    auto argValue = QVariant{};
+Geometry Geometry::transformed(const QMatrix4x4 &matrix) const
+{
+    // The polygons are shared implicitly, so that this doesn't copy them.
+    auto transformed = Geometry{m_polygons, m_attributes};
+    transformed.m_transform = m_transform ? matrix * *m_transform : matrix;
+    transformed.m_cache->source = m_transform ? m_cache->source : m_cache;
+    return transformed;
+}
 
-    if (const auto scalar = match.captured(u"scalar"); !scalar.isEmpty()) {
-        argValue = scalar.toFloat();
-    } else if (const auto x = match.captured(u"vecx"); !x.isEmpty()) {
-        if (const auto y = match.captured(u"vecy"); !x.isEmpty())
-            if (const auto z = match.captured(u"vecz"); !x.isEmpty())
-                argValue = QVector3D{x.toFloat(), y.toFloat(), z.toFloat()};
+CompactGeometry::CompactGeometry(const Geometry &geometry)
+    : m_attributes{geometry.attributes()}
+    , m_error{geometry.error()}
+{
+    const auto &polygons = geometry.polygons();
+    const auto vertexCount = std::accumulate(polygons.cbegin(), polygons.cend(), qsizetype{0},
+                                             [](qsizetype sum, const Polygon &polygon) {
+        return sum + polygon.size();
+    });
+
+    m_vertices.reserve(vertexCount);
+    m_polygons.reserve(polygons.size());
+    m_planes.reserve(polygons.size());
+
+    for (const auto &polygon: polygons) {
+        m_polygons.append(PolygonEntry{static_cast<quint32>(m_vertices.size()),
+                                       static_cast<quint32>(polygon.size()),
+                                       polygon.attribute()});
+        m_planes.append(polygon.plane());
+        m_vertices += polygon.vertices();
     }
+}
 
-    if (!valueSpec->contains(argValue.userType())) {
-        qCWarning(lcGeometry, R"(Unsupported value type for argument "%ls" of %ls primitive)",
-                  qUtf16Printable(argName), qUtf16Printable(primitive));
-        return {};
-    }
+std::span<const Vertex> CompactGeometry::vertices(qsizetype index) const
+{
+    const auto &entry = m_polygons[index];
+    return {m_vertices.constData() + entry.firstVertex, entry.vertexCount};
+}
 
-    return argValue;
+Polygon CompactGeometry::polygon(qsizetype index) const
+{
+    const auto &entry = m_polygons[index];
+    return Polygon{m_vertices.mid(entry.firstVertex, entry.vertexCount),
+                   entry.attribute, m_planes[index]};
 }
 
-} // namespace
+Geometry CompactGeometry::toGeometry() const
+{
+    auto polygons = QList<Polygon>{};
+    polygons.reserve(m_polygons.size());
 
-Geometry parseGeometry(QString expression)
+    for (auto i = qsizetype{0}; i < m_polygons.size(); ++i)
+        polygons.append(polygon(i));
+
+    return Geometry{std::move(polygons), m_attributes, m_error};
+}
+
+BoundingBox CompactGeometry::boundingBox() const
 {
-    static const auto s_callPattern = QRegularExpression{R"(^(?<name>[a-z]+)\((?<args>[^)]*\))$)"};
-    static const auto s_argPattern  = QRegularExpression{R"(\s*(?<name>[a-z]+)\s*=\s*(?:)"
-                                                         R"((?<scalar>[+-]?\d+(?:\.\d*)?)|\[)"
-                                                         R"(\s*(?<vecx>[+-]?\d+(?:\.\d*)?)\s*,)"
-                                                         R"(\s*(?<vecy>[+-]?\d+(?:\.\d*)?)\s*,)"
-                                                         R"(\s*(?<vecz>[+-]?\d+(?:\.\d*)?)\s*)"
-                                                         R"(\])\s*[,)])"};
-
-    Q_ASSERT_X(s_callPattern.isValid(), "s_callPattern", qPrintable(s_callPattern.errorString()));
-    Q_ASSERT_X(s_argPattern.isValid(), "s_argPattern", qPrintable(s_argPattern.errorString()));
-
-    static constexpr auto scalarType = qMetaTypeId<float>();
-    static constexpr auto vectorType = qMetaTypeId<QVector3D>();
-
-    static const auto s_supportedArguments = QMap<QString, ArgumentTypeMap> {
-        {"cube", {{"center", {vectorType}},
-                  {"r",      {scalarType, vectorType}}}},
-
-        {"cylinder", {{"start",  {vectorType}},
-                      {"center", {vectorType}},
-                      {"end",    {vectorType}},
-                      {"h",      {scalarType}},
-                      {"r",      {scalarType}},
-                      {"slices", {scalarType}}}},
-
-        {"sphere", {{"center", {vectorType}},
-                    {"r",      {scalarType}},
-                    {"slices", {scalarType}},
-                    {"stacks", {scalarType}}}},
-    };
+    return BoundingBox::fromVertices({m_vertices.constData(), static_cast<std::size_t>(m_vertices.size())});
+}
 
-    const auto parsedExpression = s_callPattern.match(expression);
+CompactGeometry CompactGeometry::transformed(const QMatrix4x4 &matrix) const
+{
+    auto transformed = *this;
 
-    if (!parsedExpression.hasMatch())
-        return Geometry{Error::FileFormatError};
+    Simd::transformVertices(matrix, findRotation(matrix), m_vertices.constData(), m_vertices.size(),
+                            transformed.m_vertices.data());
 
-    auto primitive = parsedExpression.captured(u"name");
-    const auto argSpec = s_supportedArguments.constFind(primitive);
+    const auto cofactors = cofactorMatrix(matrix);
+    const auto affine = isAffine(matrix);
 
-    if (argSpec == s_supportedArguments.constEnd()) {
-        qCWarning(lcGeometry, R"(Unsupported primitive: "%ls")",
-                  qUtf16Printable(primitive));
+    for (auto i = qsizetype{0}; i < m_polygons.size(); ++i) {
+        const auto vertices = transformed.vertices(i);
 
-        return Geometry{Error::NotSupportedError};
+        // Perspective divisions don't map planes linearly.
+        if (affine) {
+            transformed.m_planes[i] = transformedPlane(m_planes[i], cofactors, vertices[0].position());
+        } else {
+            transformed.m_planes[i] = Plane::fromPoints(vertices[0].position(),
+                                                        vertices[1].position(),
+                                                        vertices[2].position());
+        }
     }
 
-    const auto argList = parsedExpression.capturedView(u"args");
-    auto arguments = QVariantMap{};
-
-    if (argList != u")") {
-        if (auto it = s_argPattern.globalMatch(argList); it.hasNext()) {
-            auto expectedStart = 0;
+    return transformed;
+}
 
-            while (it.hasNext()) {
-                const auto match = it.next();
+IndexedGeometry::IndexedGeometry(const Geometry &geometry)
+    : m_attributes{geometry.attributes()}
+    , m_error{geometry.error()}
+{
+    const auto &polygons = geometry.polygons();
+    const auto indexCount = std::accumulate(polygons.cbegin(), polygons.cend(), qsizetype{0},
+                                            [](qsizetype sum, const Polygon &polygon) {
+        return sum + polygon.size();
+    });
 
-                if (match.capturedStart() != expectedStart) {
-                    const auto length = match.capturedStart() - expectedStart;
-                    const auto expression = argList.mid(expectedStart, length);
-                    qCWarning(lcGeometry, R"(Unexpected expression: "%ls")",
-                              qUtf16Printable(expression.toString()));
-                    return Geometry{Error::FileFormatError};
-                }
+    auto pool = std::unordered_map<Vertex, quint32, Utils::VertexHash>{};
+    pool.reserve(indexCount);
 
-                expectedStart = match.capturedEnd();
-                auto argName = match.captured(u"name");
+    m_indices.reserve(indexCount);
+    m_polygons.reserve(polygons.size());
+    m_planes.reserve(polygons.size());
 
-                if (arguments.contains(argName)) {
-                    qCWarning(lcGeometry, R"(Duplicate argument "%ls")", qUtf16Printable(argName));
-                    return Geometry{Error::FileFormatError};
-                }
+    for (const auto &polygon: polygons) {
+        m_polygons.append(PolygonEntry{static_cast<quint32>(m_indices.size()),
+                                       static_cast<quint32>(polygon.size()),
+                                       polygon.attribute()});
+        m_planes.append(polygon.plane());
 
-                auto argValue = parseArgument(primitive, argName, match, *argSpec);
+        for (const auto &vertex: polygon.vertices()) {
+            const auto [it, inserted] = pool.try_emplace(vertex, static_cast<quint32>(m_vertices.size()));
 
-                if (!argValue.isValid()) // NOTE: default construction values were null for Qt5
-                    return Geometry{Error::FileFormatError};
+            if (inserted)
+                m_vertices.append(vertex);
 
-                arguments.insert(std::move(argName), std::move(argValue));
-            }
-        } else {
-            qCWarning(lcGeometry, R"(Invalid argument list: "(%ls")",
-                      qUtf16Printable(argList.toString()));
-            return Geometry{Error::FileFormatError};
+            m_indices.append(it->second);
         }
     }
+}
 
-    return createGeometry(std::move(primitive), std::move(arguments));
+std::span<const quint32> IndexedGeometry::indices(qsizetype index) const
+{
+    const auto &entry = m_polygons[index];
+    return {m_indices.constData() + entry.firstIndex, entry.indexCount};
 }
 
-Geometry cube(QVector3D center, QVector3D size)
+Polygon IndexedGeometry::polygon(qsizetype index) const
+{
+    const auto &entry = m_polygons[index];
+
+    auto vertices = VertexList{};
+    vertices.reserve(entry.indexCount);
+
+    for (const auto i: indices(index))
+        vertices.append(m_vertices[i]);
+
+    return Polygon{std::move(vertices), entry.attribute, m_planes[index]};
+}
+
+Geometry IndexedGeometry::toGeometry() const
+{
+    auto polygons = QList<Polygon>{};
+    polygons.reserve(m_polygons.size());
+
+    for (auto i = qsizetype{0}; i < m_polygons.size(); ++i)
+        polygons.append(polygon(i));
+
+    return Geometry{std::move(polygons), m_attributes, m_error};
+}
+
+namespace {
+
+Geometry makeCube(QVector3D center, QVector3D size)
 {
     const auto makePolygon = [center, size](std::array<int, 4> indices, QVector3D normal) {
-        QList<Vertex> vertices;
+        VertexList vertices;
 
         vertices.reserve(indices.size());
         std::transform(indices.begin(), indices.end(), std::back_inserter(vertices), [=](int i) {
@@ -436,26 +1314,52 @@ Geometry cube(QVector3D center, QVector3D size)
     }};
 }
 
-Geometry cube(QVector3D center, float size)
-{
-    return cube(std::move(center), {size, size, size});
-}
-
-Geometry sphere(QVector3D center, float radius, int slices, int stacks)
+Geometry makeSphere(QVector3D center, float radius, int slices, int stacks)
 {
     auto polygons = QList<Polygon>{};
 
-    const auto vertex = [center, radius, slices, stacks](int i, int j) {
+    // Each vertex is shared by up to four polygons, therefore all
+    // of them are computed upfront from tables of sines and cosines.
+    const auto columns = std::max(slices, 0) + 1;
+    const auto rows = std::max(stacks, 0) + 1;
+
+    auto cosTheta = QVarLengthArray<float, 64>(columns);
+    auto sinTheta = QVarLengthArray<float, 64>(columns);
+    auto cosPhi = QVarLengthArray<float, 64>(rows);
+    auto sinPhi = QVarLengthArray<float, 64>(rows);
+
+    for (auto i = 0; i < columns; ++i) {
         const auto theta = 2 * M_PI * i / slices;
+        cosTheta[i] = cosf(theta);
+        sinTheta[i] = sinf(theta);
+    }
+
+    for (auto j = 0; j < rows; ++j) {
         const auto phi = M_PI * j / stacks;
+        cosPhi[j] = cosf(phi);
+        sinPhi[j] = sinf(phi);
+    }
+
+    auto grid = VertexList{};
+    grid.reserve(columns * rows);
+
+    for (auto i = 0; i < columns; ++i) {
+        for (auto j = 0; j < rows; ++j) {
+            const auto normal = QVector3D{cosTheta[i] * sinPhi[j], cosPhi[j], sinTheta[i] * sinPhi[j]};
+            grid.append(Vertex{center + normal * radius, normal});
+        }
+    }
 
-        const auto normal = QVector3D{cosf(theta) * sinf(phi), cosf(phi), sinf(theta) * sinf(phi)};
-        return Vertex{center + normal * radius, normal};
+    const auto vertex = [&grid, rows](int i, int j) {
+        return grid[i * rows + j];
     };
 
+    polygons.reserve(std::max(slices, 0) * std::max(stacks, 0));
+
     for (auto i = 0; i < slices; ++i) {
         for (auto j = 0; j < stacks; ++j) {
-            auto vertices = QList<Vertex>{};
+            auto vertices = VertexList{};
+            vertices.reserve(4);
             vertices.append(vertex(i, j));
 
             if (j > 0)
@@ -471,7 +1375,7 @@ Geometry sphere(QVector3D center, float radius, int slices, int stacks)
     return Geometry{std::move(polygons)};
 }
 
-Geometry cylinder(QVector3D start, QVector3D end, float radius, float slices)
+Geometry makeCylinder(QVector3D start, QVector3D end, float radius, float slices)
 {
     auto polygons = QList<Polygon>{};
 
@@ -483,21 +1387,153 @@ Geometry cylinder(QVector3D start, QVector3D end, float radius, float slices)
     const auto vertexStart = Vertex{start, -axisZ};
     const auto vertexEnd = Vertex{end, axisZ};
 
-    const auto point = [=](int stack, int slice, int normalBlend) {
+    // The direction of each slice is needed by six vertices, therefore
+    // they are computed only once. The last one closes the ring.
+    auto directions = QVector<QVector3D>{};
+
+    const auto direction = [=](int slice) {
         const auto phi = 2 * M_PI * slice / slices;
-        const auto out = (axisX * cosf(phi)) + (axisY * sinf(phi));
+        return (axisX * cosf(phi)) + (axisY * sinf(phi));
+    };
+
+    for (auto i = 0; i < slices; ++i)
+        directions.append(direction(i));
+
+    directions.append(direction(directions.size()));
+
+    const auto point = [=, &directions](int stack, int slice, int normalBlend) {
+        const auto out = directions[slice];
         auto pos = start + (ray * stack) + (out * radius);
         auto normal = out * (1 - abs(normalBlend)) + (axisZ * normalBlend);
         return Vertex{std::move(pos), std::move(normal)};
     };
 
+    polygons.reserve(3 * (directions.size() - 1));
+
     for (auto i = 0; i < slices; ++i) {
         polygons += Polygon{{vertexStart, point(0, i, -1), point(0, i + 1, -1)}};
         polygons += Polygon{{point(0, i + 1, 0), point(0, i, 0), point(1, i, 0), point(1, i + 1, 0)}};
         polygons += Polygon{{vertexEnd, point(1, i + 1, 1), point(1, i, 1)}};
     }
 
-    return Geometry{std::move(polygons)};
+    return Geometry{std::move(polygons)};
+}
+
+/// Normalizes parameters of primitives, so that equal values give equal keys.
+/// Negative zero equals positive zero, but has different bits.
+float keyValue(float value)
+{
+    return value == 0 ? 0.0f : value;
+}
+
+int keyValue(int value)
+{
+    return value;
+}
+
+QVector3D keyValue(QVector3D value)
+{
+    return {keyValue(value.x()), keyValue(value.y()), keyValue(value.z())};
+}
+
+/// Identifies a primitive by its `kind`, and by the exact bits of its parameters.
+template<typename... Args>
+QByteArray primitiveKey(char kind, const Args &...args)
+{
+    auto key = QByteArray{1, kind};
+
+    const auto append = [&key](const auto &value) {
+        key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+
+    (append(keyValue(args)), ...);
+    return key;
+}
+
+struct PrimitiveCache
+{
+    QMutex mutex;
+    QCache<QByteArray, Geometry> geometries{defaultPrimitiveCacheLimit()};
+};
+
+PrimitiveCache &primitiveCache()
+{
+    static auto cache = PrimitiveCache{};
+    return cache;
+}
+
+/// Returns a shared copy of the primitive identified by `key`,
+/// which gets created by `make` if it isn't in the cache yet.
+template<typename Factory>
+Geometry cachedPrimitive(const QByteArray &key, const Factory &make)
+{
+    auto &cache = primitiveCache();
+
+    {
+        const auto locker = QMutexLocker{&cache.mutex};
+
+        if (const auto geometry = cache.geometries.object(key))
+            return *geometry;
+    }
+
+    // The lock is released while creating the primitive, so that
+    // different primitives can get created concurrently.
+    auto geometry = make();
+
+    // Cached primitives also keep the BSP tree built from them alive. Primitives are
+    // convex, so that no polygon gets split, and the tree has the very same polygons.
+    const auto locker = QMutexLocker{&cache.mutex};
+    const auto cost = std::max<qsizetype>(1, 2 * geometry.polygons().size());
+    cache.geometries.insert(key, new Geometry{geometry}, static_cast<int>(cost));
+
+    return geometry;
+}
+
+} // namespace
+
+Geometry parseGeometry(QString expression)
+{
+    return compileExpression(expression).evaluate();
+}
+
+Geometry cube(QVector3D center, QVector3D size)
+{
+    return cachedPrimitive(primitiveKey('c', center, size), [center, size] {
+        return makeCube(center, size);
+    });
+}
+
+Geometry cube(QVector3D center, float size)
+{
+    return cube(std::move(center), {size, size, size});
+}
+
+Geometry sphere(QVector3D center, float radius, int slices, int stacks)
+{
+    return cachedPrimitive(primitiveKey('s', center, radius, slices, stacks), [=] {
+        return makeSphere(center, radius, slices, stacks);
+    });
+}
+
+Geometry cylinder(QVector3D start, QVector3D end, float radius, float slices)
+{
+    return cachedPrimitive(primitiveKey('z', start, end, radius, slices), [=] {
+        return makeCylinder(start, end, radius, slices);
+    });
+}
+
+void setPrimitiveCacheLimit(int polygonCount)
+{
+    auto &cache = primitiveCache();
+    const auto locker = QMutexLocker{&cache.mutex};
+    cache.geometries.setMaxCost(polygonCount);
+}
+
+int primitiveCacheLimit()
+{
+    auto &cache = primitiveCache();
+    const auto locker = QMutexLocker{&cache.mutex};
+    return static_cast<int>(cache.geometries.maxCost());
 }
 
 Geometry cylinder(QVector3D center, float height, float radius, float slices)
@@ -507,124 +1543,500 @@ Geometry cylinder(QVector3D center, float height, float radius, float slices)
                     radius, slices);
 }
 
-Geometry merge(Geometry lhs, Geometry rhs, int limit)
+Geometry merge(Geometry lhs, Geometry rhs, Options options)
 {
     if (reportError(lcOperator(), lhs.error(), "Invalid lhs geometry"))
         return Geometry{lhs.error()};
     if (reportError(lcOperator(), rhs.error(), "Invalid rhs geometry"))
-        return Geometry{lhs.error()};
+        return Geometry{rhs.error()};
+
+    options = withAbsoluteTolerance(std::move(options), lhs.boundingBox().united(rhs.boundingBox()));
+
+    const auto cullable = canCullByBounds(lhs, rhs);
+
+    // Disjoint geometries cannot clip each other.
+    if (cullable && !lhs.boundingBox().intersects(rhs.boundingBox(), options.tolerance))
+        return makeResult(lhs.polygons() + rhs.polygons(), lhs, rhs);
+
+    if (cullable && options.overlapCulling) {
+        auto a = CulledOperand{};
+        auto b = CulledOperand{};
 
+        if (const auto error = cullOperands(lhs, rhs, options, &a, &b); error != Error::NoError)
+            return Geometry{error};
+
+        return makeResult(operateCulled(Operation::Merge, a, b), lhs, rhs);
+    }
+
+    auto arena = NodeArena{lhs, rhs, options};
     auto a = Node{};
     auto b = Node{};
 
-    if (const auto error = a.build(lhs.polygons(), limit);
+    if (const auto error = copyTree(lhs, options, arena.resource(), &a);
         reportError(lcOperator(), error, "Could not build BSP tree from lhs geometry"))
         return Geometry{error};
-    if (const auto error = b.build(rhs.polygons(), limit);
+    if (const auto error = copyTree(rhs, options, arena.resource(), &b);
         reportError(lcOperator(), error, "Could not build BSP tree from rhs geometry"))
         return Geometry{error};
 
-    a.clipTo(b);
-    b.clipTo(a);
+    // Clipping removes polygons, but keeps the planes of the trees.
+    // Therefore each tree needs to be flattened only once.
+    const auto clipA = FlatTree{a, FlatTree::Mode::PlanesOnly};
+    const auto clipB = FlatTree{b, FlatTree::Mode::PlanesOnly};
+
+    a.clipTo(clipB, options);
+    b.clipTo(clipA, options);
     b.invert();
-    b.clipTo(a);
+    b.clipTo(clipA, options);
     b.invert();
 
-    if (const auto error = a.build(b.allPolygons(), limit);
+    if (const auto error = a.build(b.allPolygons(), options);
         reportError(lcOperator(), error, "Could not build BSP tree from transformed tree"))
         return Geometry{error};
 
-    return Geometry{a.allPolygons()};
+    return makeResult(a.allPolygons(), lhs, rhs);
 }
 
-Geometry subtract(Geometry lhs, Geometry rhs, int limit)
+Geometry subtract(Geometry lhs, Geometry rhs, Options options)
 {
     if (reportError(lcOperator(), lhs.error(), "Invalid lhs geometry"))
         return Geometry{lhs.error()};
     if (reportError(lcOperator(), rhs.error(), "Invalid rhs geometry"))
-        return Geometry{lhs.error()};
+        return Geometry{rhs.error()};
+
+    options = withAbsoluteTolerance(std::move(options), lhs.boundingBox().united(rhs.boundingBox()));
+
+    const auto cullable = canCullByBounds(lhs, rhs);
+
+    // Disjoint geometries cannot clip each other.
+    if (cullable && !lhs.boundingBox().intersects(rhs.boundingBox(), options.tolerance))
+        return makeResult(lhs.polygons(), lhs, rhs);
 
+    if (cullable && options.overlapCulling) {
+        auto a = CulledOperand{};
+        auto b = CulledOperand{};
+
+        if (const auto error = cullOperands(lhs, rhs, options, &a, &b); error != Error::NoError)
+            return Geometry{error};
+
+        return makeResult(operateCulled(Operation::Subtract, a, b), lhs, rhs);
+    }
+
+    auto arena = NodeArena{lhs, rhs, options};
     auto a = Node{};
     auto b = Node{};
 
-    if (const auto error = a.build(lhs.polygons(), limit);
+    if (const auto error = copyTree(lhs, options, arena.resource(), &a);
         reportError(lcOperator(), error, "Could not build BSP tree from lhs geometry"))
         return Geometry{error};
-    if (const auto error = b.build(rhs.polygons(), limit);
+    if (const auto error = copyTree(rhs, options, arena.resource(), &b);
         reportError(lcOperator(), error, "Could not build BSP tree from rhs geometry"))
         return Geometry{error};
 
     a.invert();
-    a.clipTo(b);
-    b.clipTo(a);
+
+    // Clipping removes polygons, but keeps the planes of the trees.
+    // Therefore each tree needs to be flattened only once.
+    const auto clipA = FlatTree{a, FlatTree::Mode::PlanesOnly};
+    const auto clipB = FlatTree{b, FlatTree::Mode::PlanesOnly};
+
+    a.clipTo(clipB, options);
+    b.clipTo(clipA, options);
     b.invert();
-    b.clipTo(a);
+    b.clipTo(clipA, options);
     b.invert();
 
-    if (const auto error = a.build(b.allPolygons(), limit);
+    if (const auto error = a.build(b.allPolygons(), options);
         reportError(lcOperator(), error, "Could not build BSP tree from transformed tree"))
         return Geometry{error};
 
     a.invert();
 
-    return Geometry{a.allPolygons()};
+    return makeResult(a.allPolygons(), lhs, rhs);
 }
 
-Geometry intersect(Geometry lhs, Geometry rhs, int limit)
+Geometry intersect(Geometry lhs, Geometry rhs, Options options)
 {
     if (reportError(lcOperator(), lhs.error(), "Invalid lhs geometry"))
         return Geometry{lhs.error()};
     if (reportError(lcOperator(), rhs.error(), "Invalid rhs geometry"))
-        return Geometry{lhs.error()};
+        return Geometry{rhs.error()};
+
+    options = withAbsoluteTolerance(std::move(options), lhs.boundingBox().united(rhs.boundingBox()));
 
+    const auto cullable = canCullByBounds(lhs, rhs);
+
+    // Disjoint geometries have no space in common.
+    if (cullable && !lhs.boundingBox().intersects(rhs.boundingBox(), options.tolerance))
+        return makeResult({}, lhs, rhs);
+
+    if (cullable && options.overlapCulling) {
+        auto a = CulledOperand{};
+        auto b = CulledOperand{};
+
+        if (const auto error = cullOperands(lhs, rhs, options, &a, &b); error != Error::NoError)
+            return Geometry{error};
+
+        return makeResult(operateCulled(Operation::Intersect, a, b), lhs, rhs);
+    }
+
+    auto arena = NodeArena{lhs, rhs, options};
     auto a = Node{};
     auto b = Node{};
 
-    if (const auto error = a.build(lhs.polygons(), limit);
+    if (const auto error = copyTree(lhs, options, arena.resource(), &a);
         reportError(lcOperator(), error, "Could not build BSP tree from lhs geometry"))
         return Geometry{error};
-    if (const auto error = b.build(rhs.polygons(), limit);
+    if (const auto error = copyTree(rhs, options, arena.resource(), &b);
         reportError(lcOperator(), error, "Could not build BSP tree from rhs geometry"))
         return Geometry{error};
 
     a.invert();
-    b.clipTo(a);
+
+    // Clipping removes polygons, but keeps the planes of the trees.
+    // Therefore each tree needs to be flattened only once.
+    const auto clipA = FlatTree{a, FlatTree::Mode::PlanesOnly};
+
+    b.clipTo(clipA, options);
     b.invert();
-    a.clipTo(b);
-    b.clipTo(a);
+    a.clipTo(FlatTree{b, FlatTree::Mode::PlanesOnly}, options);
+    b.clipTo(clipA, options);
 
-    if (const auto error = a.build(b.allPolygons(), limit);
+    if (const auto error = a.build(b.allPolygons(), options);
         reportError(lcOperator(), error, "Could not build BSP tree from transformed tree"))
         return Geometry{error};
 
     a.invert();
 
-    return Geometry{a.allPolygons()};
+    return makeResult(a.allPolygons(), lhs, rhs);
+}
+
+Geometry merge(QList<Geometry> geometries, Options options)
+{
+    return reduce(std::move(geometries), options, [](Geometry lhs, Geometry rhs, const Options &options) {
+        return merge(std::move(lhs), std::move(rhs), options);
+    });
+}
+
+Geometry subtract(Geometry lhs, QList<Geometry> geometries, Options options)
+{
+    if (geometries.isEmpty())
+        return lhs;
+
+    return subtract(std::move(lhs), merge(std::move(geometries), options), options);
+}
+
+Geometry intersect(QList<Geometry> geometries, Options options)
+{
+    return reduce(std::move(geometries), options, [](Geometry lhs, Geometry rhs, const Options &options) {
+        return intersect(std::move(lhs), std::move(rhs), options);
+    });
+}
+
+IncrementalOperation::IncrementalOperation(Operation operation, Geometry lhs, Geometry rhs, Options options)
+    : m_operation{operation}
+    , m_options{std::move(options)}
+    , m_lhs{std::move(lhs), {}, {}, true}
+    , m_rhs{std::move(rhs), {}, {}, true}
+{
+    // The tolerance must not change with the operands, as this would invalidate all fragments.
+    m_options = withAbsoluteTolerance(std::move(m_options), m_lhs.geometry.boundingBox()
+                                      .united(m_rhs.geometry.boundingBox()));
+    update(&m_lhs, {});
+}
+
+Geometry IncrementalOperation::result() const
+{
+    if (m_error != Error::NoError)
+        return Geometry{m_error};
+
+    auto polygons = QList<Polygon>{};
+
+    for (const auto operand: {&m_lhs, &m_rhs}) {
+        for (const auto &fragments: operand->fragments)
+            polygons += fragments;
+    }
+
+    return makeResult(std::move(polygons), m_lhs.geometry, m_rhs.geometry);
+}
+
+void IncrementalOperation::setLhs(Geometry lhs)
+{
+    const auto region = m_lhs.geometry.boundingBox().united(lhs.boundingBox());
+    m_lhs.geometry = std::move(lhs);
+    update(&m_lhs, region);
+}
+
+void IncrementalOperation::setRhs(Geometry rhs)
+{
+    const auto region = m_rhs.geometry.boundingBox().united(rhs.boundingBox());
+    m_rhs.geometry = std::move(rhs);
+    update(&m_rhs, region);
+}
+
+void IncrementalOperation::update(Operand *changed, const BoundingBox &region)
+{
+    const auto other = (changed == &m_lhs ? &m_rhs : &m_lhs);
+
+    // After failures, and initially, the other operand has no valid fragments yet.
+    // Turning a bounded operand into an unbounded one, or the other way around,
+    // changes space everywhere, and not just within the changed region.
+    const auto bounded = changed->geometry.isBounded();
+    const auto updateAll = (m_error != Error::NoError
+                            || other->fragments.size() != other->geometry.polygons().size()
+                            || bounded != changed->bounded);
+
+    changed->bounded = bounded;
+
+    if (updateAll)
+        other->bounded = other->geometry.isBounded();
+
+    m_error = [this] {
+        if (reportError(lcOperator(), m_lhs.geometry.error(), "Invalid lhs geometry"))
+            return m_lhs.geometry.error();
+        if (reportError(lcOperator(), m_rhs.geometry.error(), "Invalid rhs geometry"))
+            return m_rhs.geometry.error();
+
+        return Error::NoError;
+    }();
+
+    auto lhsTree = std::variant<std::shared_ptr<const Node>, Error>{};
+    auto rhsTree = std::variant<std::shared_ptr<const Node>, Error>{};
+
+    if (m_error == Error::NoError) {
+        lhsTree = m_lhs.geometry.tree(m_options);
+        rhsTree = m_rhs.geometry.tree(m_options);
+
+        if (const auto error = std::get_if<Error>(&lhsTree);
+            error && reportError(lcOperator(), *error, "Could not build BSP tree from lhs geometry"))
+            m_error = *error;
+        else if (const auto error = std::get_if<Error>(&rhsTree);
+                 error && reportError(lcOperator(), *error, "Could not build BSP tree from rhs geometry"))
+            m_error = *error;
+    }
+
+    if (m_error != Error::NoError) {
+        m_lhs.fragments.clear();
+        m_rhs.fragments.clear();
+        return;
+    }
+
+    const auto updateOperand = [this](Operand *operand, const Geometry &otherGeometry,
+                                      const Node &otherTree, const BoundingBox &region,
+                                      bool updateAll) {
+        const auto side = (operand == &m_lhs ? Side::Lhs : Side::Rhs);
+        const auto otherBounds = otherGeometry.boundingBox();
+        const auto otherBounded = (operand == &m_lhs ? m_rhs : m_lhs).bounded;
+        const auto inverseOtherTree = otherTree.inverted();
+        const auto &polygons = operand->geometry.polygons();
+
+        if (updateAll) {
+            operand->bounds.clear();
+            operand->bounds.reserve(polygons.size());
+
+            for (const auto &polygon: polygons)
+                operand->bounds.append(BoundingBox::fromPolygon(polygon));
+        }
+
+        const auto updateFragments = [&](qsizetype first, qsizetype last) {
+            for (auto i = first; i < last; ++i) {
+                // Polygons outside of the changed region keep their fragments.
+                if (!updateAll && !operand->bounds[i].intersects(region, m_options.tolerance))
+                    continue;
+
+                if (otherBounded && !operand->bounds[i].intersects(otherBounds, m_options.tolerance)) {
+                    if (keepsDistant(m_operation, side))
+                        operand->fragments[i] = {polygons[i]};
+                    else
+                        operand->fragments[i].clear();
+                } else {
+                    operand->fragments[i] = clipNearby(m_operation, side, {polygons[i]},
+                                                       otherTree, inverseOtherTree);
+                }
+            }
+        };
+
+        constexpr auto minimumBatchSize = qsizetype{256};
+
+        if (m_options.parallel && polygons.size() >= 2 * minimumBatchSize) {
+            auto tasks = Utils::TaskGroup{};
+
+            for (auto first = qsizetype{0}; first < polygons.size(); first += minimumBatchSize) {
+                const auto last = std::min(first + minimumBatchSize, polygons.size());
+                tasks.run([&updateFragments, first, last] { updateFragments(first, last); });
+            }
+
+            tasks.wait();
+        } else {
+            updateFragments(0, polygons.size());
+        }
+    };
+
+    const auto &lhsNode = *std::get<std::shared_ptr<const Node>>(lhsTree);
+    const auto &rhsNode = *std::get<std::shared_ptr<const Node>>(rhsTree);
+    const auto changedTree = (changed == &m_lhs ? &lhsNode : &rhsNode);
+    const auto otherTree = (changed == &m_lhs ? &rhsNode : &lhsNode);
+
+    changed->fragments.clear();
+    changed->fragments.resize(changed->geometry.polygons().size());
+
+    if (updateAll) {
+        other->fragments.clear();
+        other->fragments.resize(other->geometry.polygons().size());
+    }
+
+    updateOperand(changed, other->geometry, *otherTree, region, true);
+    updateOperand(other, changed->geometry, *changedTree, region, updateAll);
 }
 
-std::variant<Node, Error> Node::fromPolygons(QList<Polygon> polygons, int limit)
+std::variant<Node, Error> Node::fromPolygons(QList<Polygon> polygons, Options options)
 {
     auto node = Node{};
 
-    if (const auto error = node.build(std::move(polygons), limit);
+    if (const auto error = node.build(std::move(polygons), options);
         reportError(lcNode(), error, "Could not build BSP tree from polygons"))
         return {error};
 
     return {std::move(node)};
 }
 
-void Node::invert()
+Node::~Node()
 {
-    std::for_each(m_polygons.begin(), m_polygons.end(), &flip<Polygon>);
+    // Release deep trees without recursing into the destructors of the subtrees.
+    auto pending = std::vector<std::shared_ptr<Node>>{};
+    pending.emplace_back(std::move(m_front));
+    pending.emplace_back(std::move(m_back));
+
+    while (!pending.empty()) {
+        auto node = std::move(pending.back());
+        pending.pop_back();
+
+        if (node && node.use_count() == 1) {
+            pending.emplace_back(std::move(node->m_front));
+            pending.emplace_back(std::move(node->m_back));
+        }
+    }
+}
 
-    m_plane.flip();
+Plane Node::plane() const
+{
+    return m_inverted ? flipped(m_plane) : m_plane;
+}
+
+QList<Polygon> Node::polygons() const
+{
+    auto polygons = QList<Polygon>{};
+    appendPolygons(&polygons, m_polygons, m_inverted);
+    return polygons;
+}
+
+std::shared_ptr<Node> Node::front() const
+{
+    return m_inverted ? invertedChild(m_back) : m_front;
+}
+
+std::shared_ptr<Node> Node::back() const
+{
+    return m_inverted ? invertedChild(m_front) : m_back;
+}
+
+std::shared_ptr<Node> Node::makeChild() const
+{
+    auto child = std::allocate_shared<Node>(std::pmr::polymorphic_allocator<Node>{m_resource}, m_resource);
+    child->m_precision = m_precision;
+    child->m_tolerance = m_tolerance;
+    return child;
+}
+
+std::shared_ptr<Node> Node::invertedChild(const std::shared_ptr<Node> &child) const
+{
+    if (!child)
+        return {};
+
+    // Return a shallow copy, which applies this node's inversion to the child.
+    auto view = std::make_shared<Node>(*child);
+    view->invert();
+    return view;
+}
+
+Node Node::cloned(std::pmr::memory_resource *resource) const
+{
+    auto root = Node{resource};
+    auto pending = std::vector<std::pair<const Node *, Node *>>{{this, &root}};
+
+    while (!pending.empty()) {
+        const auto [source, target] = pending.back();
+        pending.pop_back();
+
+        target->m_plane = source->m_plane;
+        target->m_polygons = source->m_polygons;
+        target->m_inverted = source->m_inverted;
+        target->m_precision = source->m_precision;
+        target->m_tolerance = source->m_tolerance;
+
+        if (source->m_front) {
+            target->m_front = target->makeChild();
+            pending.emplace_back(source->m_front.get(), target->m_front.get());
+        }
+
+        if (source->m_back) {
+            target->m_back = target->makeChild();
+            pending.emplace_back(source->m_back.get(), target->m_back.get());
+        }
+    }
+
+    return root;
+}
+
+Node Node::transformed(const QMatrix4x4 &matrix, std::pmr::memory_resource *resource) const
+{
+    const auto rotation = findRotation(matrix);
+    const auto cofactors = cofactorMatrix(matrix);
+    const auto scale = findScale(matrix).x();
+
+    // Mirroring moves the space in front of each plane behind the transformed plane.
+    const auto axis = [&matrix](int column) {
+        return QVector3D{matrix(0, column), matrix(1, column), matrix(2, column)};
+    };
+
+    const auto mirrored = dotProduct(axis(0), crossProduct(axis(1), axis(2))) < 0;
+
+    auto root = Node{resource};
+    auto pending = std::vector<std::pair<const Node *, Node *>>{{this, &root}};
+
+    while (!pending.empty()) {
+        const auto [source, target] = pending.back();
+        pending.pop_back();
+
+        if (!source->m_plane.isNull()) {
+            const auto &plane = source->m_plane;
+            target->m_plane = transformedPlane(plane, cofactors, matrix * (plane.normal() * plane.w()));
+        }
+
+        target->m_polygons.reserve(source->m_polygons.size());
+
+        for (const auto &polygon: source->m_polygons)
+            target->m_polygons.append(polygon.transformed(matrix, rotation, cofactors));
 
-    if (m_front)
-        m_front->invert();
-    if (m_back)
-        m_back->invert();
+        target->m_inverted = source->m_inverted;
+        target->m_precision = source->m_precision;
+        target->m_tolerance = source->m_tolerance * scale;
 
-    std::swap(m_front, m_back);
+        const auto front = (mirrored ? source->m_back : source->m_front).get();
+        const auto back = (mirrored ? source->m_front : source->m_back).get();
+
+        if (front) {
+            target->m_front = target->makeChild();
+            pending.emplace_back(front, target->m_front.get());
+        }
+
+        if (back) {
+            target->m_back = target->makeChild();
+            pending.emplace_back(back, target->m_back.get());
+        }
+    }
+
+    return root;
 }
 
 Node Node::inverted() const
@@ -634,91 +2046,379 @@ Node Node::inverted() const
     return node;
 }
 
-QList<Polygon> Node::clipPolygons(QList<Polygon> polygons) const
+QList<Polygon> Node::clipPolygons(QList<Polygon> polygons, bool polygonsFlipped) const
 {
-    if (m_plane.isNull())
-        return polygons;
+    struct Task
+    {
+        const Node *node;           // the polygons are kept if this is null
+        QList<Polygon> polygons;
+        bool inverted;
+    };
+
+    auto result = QList<Polygon>{};
+    auto pending = std::vector<Task>{};
+    pending.push_back({this, std::move(polygons), m_inverted});
 
-    auto front = QList<Polygon>{};
-    auto back = QList<Polygon>{};
+    // Front fragments are pushed last, so that they get processed first,
+    // which reproduces the order of csg.js' recursive implementation.
+    while (!pending.empty()) {
+        auto task = std::move(pending.back());
+        pending.pop_back();
 
-    for (const auto &p: polygons)
-        p.split(m_plane, &front, &back, &front, &back);
+        if (!task.node || task.node->m_plane.isNull()) {
+            result += std::move(task.polygons);
+            continue;
+        }
 
-    if (m_front)
-        front = m_front->clipPolygons(front);
+        const auto plane = task.inverted ? flipped(task.node->m_plane) : task.node->m_plane;
+        const auto frontNode = (task.inverted ? task.node->m_back : task.node->m_front).get();
+        const auto backNode = (task.inverted ? task.node->m_front : task.node->m_back).get();
 
-    if (m_back)
-        back = m_back->clipPolygons(back);
-    else
-        back.clear();
+        auto front = QList<Polygon>{};
+        auto back = QList<Polygon>{};
+
+        splitAll(task.polygons, plane, polygonsFlipped, m_tolerance, m_precision,
+                 &front, &back, &front, &back);
+
+        if (backNode && !back.isEmpty())
+            pending.push_back({backNode, std::move(back), task.inverted != backNode->m_inverted});
+        if (!front.isEmpty())
+            pending.push_back({frontNode, std::move(front), frontNode && task.inverted != frontNode->m_inverted});
+    }
+
+    return result;
+}
 
-    return front + back;
+void Node::clipTo(const Node &bsp, const Options &options)
+{
+    clipTo(FlatTree{bsp, FlatTree::Mode::PlanesOnly}, options);
 }
 
-void Node::clipTo(const Node &bsp)
+void Node::clipTo(const FlatTree &bsp, const Options &options)
 {
-    m_polygons = bsp.clipPolygons(std::move(m_polygons));
+    // Nodes with fewer polygons are collected into one task to limit the overhead.
+    constexpr auto parallelClipCutoff = 256;
+
+    // The polygons of inverted nodes are clipped as if they were flipped,
+    // so that they can stay unflipped until they get retrieved.
+    auto nodes = std::vector<std::pair<Node *, bool>>{};
+    auto pending = std::vector<std::pair<Node *, bool>>{{this, m_inverted}};
+
+    while (!pending.empty()) {
+        const auto [node, inverted] = pending.back();
+        pending.pop_back();
+
+        nodes.emplace_back(node, inverted);
+
+        if (node->m_front)
+            pending.emplace_back(node->m_front.get(), inverted != node->m_front->m_inverted);
+        if (node->m_back)
+            pending.emplace_back(node->m_back.get(), inverted != node->m_back->m_inverted);
+    }
 
-    if (m_front)
-        m_front->clipTo(bsp);
-    if (m_back)
-        m_back->clipTo(bsp);
+    if (!options.parallel) {
+        for (const auto &[node, inverted]: nodes)
+            node->m_polygons = bsp.clipPolygons(std::move(node->m_polygons), inverted, options);
+
+        return;
+    }
+
+    // The polygons of each node are clipped independently of all other nodes.
+    auto tasks = Utils::TaskGroup{};
+
+    for (auto first = nodes.begin(); first != nodes.end(); ) {
+        auto last = first;
+
+        for (auto polygonCount = qsizetype{0};
+             last != nodes.end() && polygonCount < parallelClipCutoff; ++last)
+            polygonCount += last->first->m_polygons.size();
+
+        tasks.run([&bsp, &options, first, last] {
+            for (auto it = first; it != last; ++it) {
+                const auto &[node, inverted] = *it;
+                node->m_polygons = bsp.clipPolygons(std::move(node->m_polygons), inverted, options);
+            }
+        });
+
+        first = last;
+    }
+
+    tasks.wait();
 }
 
 QList<Polygon> Node::allPolygons() const
 {
-    auto polygons = m_polygons;
+    auto polygons = QList<Polygon>{};
+    auto pending = std::vector<std::pair<const Node *, bool>>{{this, m_inverted}};
 
-    if (m_front)
-        polygons += m_front->allPolygons();
-    if (m_back)
-        polygons += m_back->allPolygons();
+    while (!pending.empty()) {
+        const auto [node, inverted] = pending.back();
+        pending.pop_back();
+
+        appendPolygons(&polygons, node->m_polygons, inverted);
+
+        const auto front = (inverted ? node->m_back : node->m_front).get();
+        const auto back = (inverted ? node->m_front : node->m_back).get();
+
+        if (back)
+            pending.emplace_back(back, inverted != back->m_inverted);
+        if (front)
+            pending.emplace_back(front, inverted != front->m_inverted);
+    }
 
     return polygons;
 }
 
-Error Node::build(QList<Polygon> polygons, int level, int limit)
+Error Node::build(QList<Polygon> polygons, Options options)
+{
+    // Subtrees with fewer polygons are not worth the overhead of a new task.
+    constexpr auto parallelBuildCutoff = 256;
+
+    if (options.toleranceMode == ToleranceMode::Relative)
+        options = withAbsoluteTolerance(std::move(options), BoundingBox::fromPolygons(polygons));
+
+    // Children inherit precision and tolerance when they get created by makeChild().
+    m_precision = options.precision;
+    m_tolerance = options.tolerance;
+
+    struct Task
+    {
+        Node *node;
+        QList<Polygon> polygons;
+        int level;
+        bool inverted;
+    };
+
+    auto result = std::atomic<Error>{Error::NoError};
+    auto tasks = std::optional<Utils::TaskGroup>{};
+
+    if (options.parallel)
+        tasks.emplace();
+
+    const auto reportFailure = [&result](Error error) {
+        auto expected = Error::NoError;
+        result.compare_exchange_strong(expected, error);
+    };
+
+    std::function<void(Task)> buildSubtree;
+    buildSubtree = [&](Task root) {
+        auto pending = std::vector<Task>{};
+        pending.push_back(std::move(root));
+
+        while (!pending.empty()) {
+            auto task = std::move(pending.back());
+            pending.pop_back();
+
+            if (options.limit > 0 && task.level == options.limit) {
+                qWarning(lcNode, "Maximum recursion level reached");
+                reportFailure(Error::RecursionError);
+                continue;
+            }
+
+            if (task.polygons.isEmpty())
+                continue;
+
+            const auto node = task.node;
+
+            // Inverted nodes store their plane flipped, their coplanar polygons
+            // flipped, and their children swapped, relative to this build.
+            if (node->m_plane.isNull()) {
+                const auto plane = findSplitPlane(task.polygons, options.splitStrategy,
+                                                  options.tolerance);
+                node->m_plane = task.inverted ? flipped(plane) : plane;
+            }
+
+            const auto plane = task.inverted ? flipped(node->m_plane) : node->m_plane;
+            auto &frontChild = task.inverted ? node->m_back : node->m_front;
+            auto &backChild = task.inverted ? node->m_front : node->m_back;
+
+            auto flippedCoplanar = QList<Polygon>{};
+            const auto coplanar = task.inverted ? &flippedCoplanar : &node->m_polygons;
+            auto front = QList<Polygon>{};
+            auto back = QList<Polygon>{};
+
+            splitAll(task.polygons, plane, false, options.tolerance, options.precision,
+                     coplanar, coplanar, &front, &back);
+
+            if (task.inverted)
+                appendPolygons(&node->m_polygons, flippedCoplanar, true);
+
+            if (!back.empty()) {
+                if (!backChild)
+                    backChild = node->makeChild();
+
+                pending.push_back({backChild.get(), std::move(back), task.level + 1,
+                                   task.inverted != backChild->m_inverted});
+            }
+
+            if (!front.empty()) {
+                if (!frontChild)
+                    frontChild = node->makeChild();
+
+                auto frontTask = Task{frontChild.get(), std::move(front), task.level + 1,
+                                      task.inverted != frontChild->m_inverted};
+
+                // The front and back subtrees are independent of each other, therefore
+                // the front subtree can be built by another thread, if one is idle.
+                if (!tasks || frontTask.polygons.size() < parallelBuildCutoff
+                    || !tasks->tryRun([&buildSubtree, frontTask] { buildSubtree(frontTask); }))
+                    pending.push_back(std::move(frontTask));
+            }
+        }
+    };
+
+    buildSubtree({this, std::move(polygons), 0, m_inverted});
+
+    if (tasks)
+        tasks->wait();
+
+    return result.load();
+}
+
+FlatTree::FlatTree(const Node &node, Mode mode)
+    : m_precision{node.m_precision}
+    , m_tolerance{node.m_tolerance}
 {
-    if (level == limit) {
-        qWarning(lcNode, "Maximum recursion level reached");
-        return Error::RecursionError;
+    if (node.m_plane.isNull() && node.m_polygons.isEmpty())
+        return;
+
+    struct Task
+    {
+        const Node *node;
+        quint32 parent;
+        bool isFront;
+        bool inverted;
+    };
+
+    auto pending = std::vector<Task>{{&node, NoChild, false, node.m_inverted}};
+
+    // Nodes are stored in pre-order, with front subtrees first. This also
+    // puts polygons into the very same order as Node::allPolygons().
+    while (!pending.empty()) {
+        const auto task = pending.back();
+        pending.pop_back();
+
+        const auto index = static_cast<quint32>(m_entries.size());
+
+        if (task.parent != NoChild) {
+            auto &parent = m_entries[task.parent];
+            (task.isFront ? parent.front : parent.back) = index;
+        }
+
+        // Planes are stored as they are seen by this tree, but polygons
+        // get flipped only on demand, as in Node::allPolygons().
+        const auto polygonCount = (mode == Mode::Full ? task.node->m_polygons.size() : 0);
+
+        m_entries.append({
+            NoChild, NoChild,
+            static_cast<quint32>(m_polygons.size()),
+            static_cast<quint32>(polygonCount),
+            task.inverted
+        });
+
+        m_planes.append(task.inverted ? flipped(task.node->m_plane) : task.node->m_plane);
+
+        if (mode == Mode::Full)
+            m_polygons += task.node->m_polygons;
+
+        const auto front = (task.inverted ? task.node->m_back : task.node->m_front).get();
+        const auto back = (task.inverted ? task.node->m_front : task.node->m_back).get();
+
+        if (back)
+            pending.push_back({back, index, false, task.inverted != back->m_inverted});
+        if (front)
+            pending.push_back({front, index, true, task.inverted != front->m_inverted});
     }
+}
 
-    if (polygons.isEmpty())
-        return Error::NoError;
+QList<Polygon> FlatTree::clipPolygons(QList<Polygon> polygons, const Options &options) const
+{
+    return clipPolygons(std::move(polygons), false, options);
+}
+
+QList<Polygon> FlatTree::clipPolygons(QList<Polygon> polygons, bool flipped,
+                                      const Options &options) const
+{
+    // Lists with fewer polygons are not worth the overhead of splitting them.
+    constexpr auto parallelClipBatchSize = 256;
+
+    if (m_entries.isEmpty())
+        return polygons;
 
-    if (m_plane.isNull())
-        m_plane = polygons.first().plane();
+    if (!options.parallel || polygons.size() < 2 * parallelClipBatchSize) {
+        auto result = QList<Polygon>{};
 
-    auto result = Error::NoError;
-    auto front = QList<Polygon>{};
-    auto back = QList<Polygon>{};
+        for (auto &kept: clipPolygonBatch(m_entries, m_planes, std::move(polygons),
+                                                 flipped, m_tolerance, m_precision))
+            result += std::move(kept.polygons);
 
-    for (const auto &p: polygons)
-        p.split(m_plane, &m_polygons, &m_polygons, &front, &back);
+        return result;
+    }
 
-    if (!front.empty()) {
-        if (!m_front)
-            m_front = std::make_shared<Node>();
+    const auto batchCount = (polygons.size() + parallelClipBatchSize - 1) / parallelClipBatchSize;
+    auto batches = std::vector<std::vector<KeptPolygons>>(static_cast<std::size_t>(batchCount));
+    auto tasks = Utils::TaskGroup{};
 
-        if (const auto error = m_front->build(std::move(front), level + 1, limit);
-            error != Error::NoError && result == Error::NoError)
-            result = error;
+    for (auto i = qsizetype{0}; i < batchCount; ++i) {
+        tasks.run([this, &batches, &polygons, flipped, i] {
+            auto batch = polygons.mid(i * parallelClipBatchSize, parallelClipBatchSize);
+            batches[static_cast<std::size_t>(i)] = clipPolygonBatch(m_entries, m_planes,
+                                                                    std::move(batch), flipped,
+                                                                    m_tolerance, m_precision);
+        });
     }
 
-    if (!back.empty()) {
-        if (!m_back)
-            m_back = std::make_shared<Node>();
+    tasks.wait();
+
+    // Restore the order of a serial clip: Polygons are grouped by the node that kept
+    // them, and nodes are visited in pre-order, which is the order of their indices.
+    auto kept = std::vector<KeptPolygons *>{};
 
-        if (const auto error = m_back->build(std::move(back), level + 1, limit);
-            error != Error::NoError && result == Error::NoError)
-            result = error;
+    for (auto &batch: batches) {
+        for (auto &keptByNode: batch)
+            kept.emplace_back(&keptByNode);
     }
 
+    std::stable_sort(kept.begin(), kept.end(), [](const auto lhs, const auto rhs) {
+        return lhs->entry < rhs->entry;
+    });
+
+    auto result = QList<Polygon>{};
+    result.reserve(polygons.size());
+
+    for (const auto keptByNode: kept)
+        result += std::move(keptByNode->polygons);
+
     return result;
 }
 
+QList<Polygon> FlatTree::allPolygons() const
+{
+    auto polygons = QList<Polygon>{};
+    polygons.reserve(m_polygons.size());
+
+    for (const auto &entry: m_entries) {
+        const auto range = m_polygons.mid(entry.firstPolygon, entry.polygonCount);
+        appendPolygons(&polygons, range, entry.inverted);
+    }
+
+    return polygons;
+}
+
+QDebug operator<<(QDebug debug, BoundingBox box)
+{
+    const auto stateGuard = QDebugStateSaver{debug};
+
+    if (box.isNull())
+        return debug.nospace() << "BoundingBox()";
+
+    return debug.nospace()
+            << "BoundingBox(minimum="
+            << box.minimum()
+            << ", maximum="
+            << box.maximum()
+            << ")";
+}
 
 QDebug operator<<(QDebug debug, Geometry geometry)
 {
@@ -19,10 +19,16 @@
 #ifndef QTCSG_H
 #define QTCSG_H
 
+#include <QHash>
+#include <QMatrix4x4>
 #include <QVariant>
+#include <QVector>
 #include <QVector3D>
 
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 
 namespace Qt3DCSG {
 class Geometry;
@@ -32,7 +38,16 @@ namespace QtCSG {
 
 Q_NAMESPACE
 
-constexpr auto defaultRecursionLimit() { return 1024; }
+/// The default limit for the depth of BSP trees. BSP trees are built and
+/// traversed without recursion, therefore no limit is applied by default.
+/// Any value less than one disables the limit.
+constexpr auto defaultRecursionLimit() { return 0; }
+
+/// The default distance below which vertices are considered to be on a plane.
+constexpr auto defaultTolerance() { return 1e-5f; }
+
+/// The default number of polygons kept in the cache of primitives.
+constexpr auto defaultPrimitiveCacheLimit() { return 1 << 16; }
 
 enum class Error
 {
@@ -45,6 +60,68 @@ enum class Error
 
 Q_ENUM_NS(Error)
 
+/// Strategies for picking the plane that partitions polygons in `Node::build()`.
+enum class SplitStrategy
+{
+    FirstPolygon,   ///< use the plane of the first polygon, just like csg.js
+    SampledCost,    ///< score sampled candidate planes by split count and balance
+};
+
+Q_ENUM_NS(SplitStrategy)
+
+/// How exactly vertices get classified relative to planes.
+enum class Precision
+{
+    Fast,           ///< compare float distances against a fixed epsilon, just like csg.js
+    Robust,         ///< scale the tolerance with the coordinates, and resolve ambiguous cases in double precision
+};
+
+Q_ENUM_NS(Precision)
+
+/// How the tolerance of an operation is interpreted.
+enum class ToleranceMode
+{
+    Absolute,       ///< the tolerance is a distance in model units
+    Relative,       ///< the tolerance is a fraction of the operands' bounding box diagonal
+};
+
+Q_ENUM_NS(ToleranceMode)
+
+/// The boolean operations on solids.
+enum class Operation
+{
+    Merge,
+    Subtract,
+    Intersect,
+};
+
+Q_ENUM_NS(Operation)
+
+/// Options controlling how BSP trees are built for CSG operations.
+struct Options
+{
+    int limit = defaultRecursionLimit();
+    SplitStrategy splitStrategy = SplitStrategy::FirstPolygon;
+    bool parallel = false; ///< use the global `QThreadPool` for large subtrees
+
+    /// Only clip the polygons near the overlap of the operands' bounding boxes.
+    /// All other polygons are kept or dropped without consulting a BSP tree.
+    /// The result covers the same space, but polygons get split differently.
+    bool overlapCulling = false;
+
+    /// Robust classification avoids sliver fragments on models with large
+    /// coordinates, which otherwise inflate the BSP trees.
+    Precision precision = Precision::Fast;
+
+    /// Vertices closer to a plane than this tolerance are considered to be on that plane.
+    /// A tolerance matching the scale of the model avoids needless splits.
+    float tolerance = defaultTolerance();
+    ToleranceMode toleranceMode = ToleranceMode::Absolute;
+};
+
+class FlatTree;
+class Node;
+
 /// Represents a vertex of a polygon. Use your own vertex class instead of this
 /// one to provide additional features like texture coordinates and vertex
 /// colors. Custom vertex classes need to provide a `pos` property and `clone()`,
@@ -84,10 +161,20 @@ public:
 private:
     friend class Qt3DCSG::Geometry; // FIXME: Build a vertex type that's simple but also directly wraps Qt3D attributes
 
+    // The position must remain the first member, the SIMD kernels rely on that.
     QVector3D m_position;
     QVector3D m_normal;
 };
 
+/// A list of vertices in contiguous storage, as needed by the SIMD kernels.
+/// Qt5's `QList` allocates elements larger than a pointer individually,
+/// only its `QVector` keeps them in one block.
+#if QT_VERSION_MAJOR < 6
+using VertexList = QVector<Vertex>;
+#else
+using VertexList = QList<Vertex>;
+#endif
+
 ///  Represents a plane in 3D space.
 class Plane
 {
@@ -115,33 +202,53 @@ private:
     float m_w;
 };
 
+namespace Simd {
+enum VertexType : quint8;
+} // namespace Simd
+
 /// Represents a convex polygon.
 /// The vertices used to initialize a polygon must
 /// be coplanar and form a convex loop.
 ///
-/// Each convex polygon has a `shared` property, which is shared between all
+/// Each convex polygon has an integer `attribute`, which is shared between all
 /// polygons that are clones of each other or were split from the same polygon.
 /// This can be used to define per-polygon properties (such as surface color).
+/// Arbitrary payloads for these ids can be stored in `Geometry::attributes()`.
 class Polygon
 {
 public:
     Polygon() = default;
 
-    explicit Polygon(QList<Vertex> vertices, QVariant shared = {})
+    explicit Polygon(VertexList vertices, int attribute = 0)
         : m_vertices{std::move(vertices)}
-        , m_shared{std::move(shared)}
+        , m_attribute{attribute}
         , m_plane{Plane::fromPoints(m_vertices[0].position(),
                                     m_vertices[1].position(),
                                     m_vertices[2].position())}
     {}
 
+    /// Deprecated: Pass an attribute id, and store its payload with `Geometry::setAttribute()`.
+    /// Equal payloads share one negative attribute id, which a `Geometry` constructed from
+    /// such polygons maps back to the payload in its `attributes()`.
+    [[deprecated("Use an attribute id and Geometry::setAttribute()")]]
+    explicit Polygon(VertexList vertices, QVariant shared)
+        : Polygon{std::move(vertices), sharedAttribute(std::move(shared))}
+    {}
+
     [[nodiscard]] auto isEmpty() const { return m_vertices.isEmpty(); }
     [[nodiscard]] auto size() const { return m_vertices.size(); }
 
-    [[nodiscard]] auto vertices() const { return m_vertices; }
-    [[nodiscard]] auto shared() const { return m_shared; }
+    /// Returns the vertices of this polygon. Rvalue polygons move their vertices out.
+    [[nodiscard]] const auto &vertices() const & { return m_vertices; }
+    [[nodiscard]] auto vertices() && { return std::move(m_vertices); }
+
+    [[nodiscard]] auto attribute() const { return m_attribute; }
     [[nodiscard]] auto plane() const { return m_plane; }
 
+    /// Deprecated: Use `attribute()`, and look up its payload with `Geometry::attribute()`.
+    [[deprecated("Use attribute() and Geometry::attribute()")]]
+    [[nodiscard]] auto shared() const { return sharedValue(m_attribute); }
+
     void flip();
 
     /// Split this polygon by `plane` if needed, then put the polygon or polygon
@@ -152,46 +259,260 @@ public:
     void split(const Plane &plane,
                QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
                QList<Polygon> *front, QList<Polygon> *back,
-               float epsilon = 1e-5) const;
+               float epsilon = defaultTolerance(), Precision precision = Precision::Fast) const;
+
+    /// Splits each of `polygons` like `split()` does. The vertices of all polygons
+    /// get classified at once, so that the SIMD kernels can use their full width
+    /// even for triangles and quads.
+    static void splitAll(const QList<Polygon> &polygons, const Plane &plane,
+                         QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
+                         QList<Polygon> *front, QList<Polygon> *back,
+                         float epsilon = defaultTolerance(), Precision precision = Precision::Fast);
 
     /// Returns a new polygon which has the transformations described
     /// by `matrix` applied to all vertices of this polygon.
     [[nodiscard]] Polygon transformed(const QMatrix4x4 &matrix) const;
 
-    [[nodiscard]] auto fields() const { return std::tie(m_vertices, m_shared, m_plane); }
+    [[nodiscard]] auto fields() const { return std::tie(m_vertices, m_attribute, m_plane); }
     [[nodiscard]] bool operator==(const Polygon &rhs) const { return fields() == rhs.fields(); }
 
 private:
-    QList<Vertex> m_vertices;
-    QVariant m_shared;
+    friend class CompactGeometry;
+    friend class Geometry;
+    friend class IndexedGeometry;
+    friend class Node;
+
+    /// Like the public `transformed()`, but gets passed what is derived from `matrix`
+    /// for transforming normals and planes, so that it can be shared by many polygons.
+    [[nodiscard]] Polygon transformed(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                                      const QMatrix4x4 &cofactors) const;
+
+    /// Like the public `split()`, but with the vertices already classified as
+    /// `vertexTypes`, and `polygonType` being the union of these types.
+    void split(const Plane &plane, const Simd::VertexType *vertexTypes, Simd::VertexType polygonType,
+               QList<Polygon> *coplanarFront, QList<Polygon> *coplanarBack,
+               QList<Polygon> *front, QList<Polygon> *back) const;
+
+    /// Maps payloads of the deprecated `shared` property to attribute ids, and back.
+    [[nodiscard]] static int sharedAttribute(QVariant shared);
+    [[nodiscard]] static QVariant sharedValue(int attribute);
+
+    explicit Polygon(VertexList vertices, int attribute, Plane plane)
+        : m_vertices{std::move(vertices)}
+        , m_attribute{attribute}
+        , m_plane{std::move(plane)}
+    {}
+
+    VertexList m_vertices;
+    int m_attribute = 0;
     Plane m_plane;
 };
 
+/// An axis-aligned bounding box. Default constructed boxes are null,
+/// they contain no point at all.
+class BoundingBox
+{
+public:
+    BoundingBox() = default;
+    BoundingBox(QVector3D minimum, QVector3D maximum)
+        : m_minimum{std::move(minimum)}
+        , m_maximum{std::move(maximum)}
+        , m_isNull{false}
+    {}
+
+    /// Returns the smallest box containing all vertices of `polygons`.
+    [[nodiscard]] static BoundingBox fromPolygons(const QList<Polygon> &polygons);
+    [[nodiscard]] static BoundingBox fromPolygon(const Polygon &polygon);
+    [[nodiscard]] static BoundingBox fromVertices(std::span<const Vertex> vertices);
+
+    [[nodiscard]] auto isNull() const { return m_isNull; }
+    [[nodiscard]] auto minimum() const { return m_minimum; }
+    [[nodiscard]] auto maximum() const { return m_maximum; }
+
+    /// Tells if this box and `other` share any point, or at least are closer
+    /// to each other than `epsilon`. Null boxes intersect no other box.
+    [[nodiscard]] bool intersects(const BoundingBox &other, float epsilon = defaultTolerance()) const;
+
+    /// Returns the box of space shared by this box and `other`, grown by `epsilon`.
+    /// The result is null if the boxes don't intersect.
+    [[nodiscard]] BoundingBox intersected(const BoundingBox &other, float epsilon = defaultTolerance()) const;
+
+    /// Returns the smallest box containing this box and `other`.
+    [[nodiscard]] BoundingBox united(const BoundingBox &other) const;
+
+private:
+    void extend(QVector3D point);
+
+    QVector3D m_minimum;
+    QVector3D m_maximum;
+    bool m_isNull = true;
+};
+
 /// Holds a binary space partition tree representing a 3D solid. Two solids can
 /// be combined using the `unite()`, `subtract()`, and `intersect()` methods.
 class Geometry
 {
 public:
-    explicit Geometry(Error error = Error::NoError)
-        : m_error{error} {}
-    explicit Geometry(QList<Polygon> polygons, Error error = Error::NoError)
-        : m_polygons{std::move(polygons)}
-        , m_error{error} {}
+    /// Maps the `Polygon::attribute()` ids to arbitrary payloads.
+    using Attributes = QHash<int, QVariant>;
+
+    explicit Geometry(Error error = Error::NoError);
+    explicit Geometry(QList<Polygon> polygons, Error error = Error::NoError);
+    explicit Geometry(QList<Polygon> polygons, Attributes attributes, Error error = Error::NoError);
 
     [[nodiscard]] auto isEmpty() const { return m_polygons.isEmpty(); }
-    [[nodiscard]] auto polygons() const { return m_polygons; }
     [[nodiscard]] Error error() const { return m_error; }
 
+    /// Returns the polygons of this geometry. Rvalue geometries move their polygons out.
+    /// A pending transform gets applied on first use, and then is shared by all copies.
+    [[nodiscard]] const QList<Polygon> &polygons() const &;
+    [[nodiscard]] QList<Polygon> polygons() &&;
+
+    /// Moves the polygons out of this geometry, which then is empty.
+    [[nodiscard]] QList<Polygon> takePolygons();
+
+    /// The payloads of the polygon attributes. The CSG operations keep the
+    /// payloads of both operands. For ids found in both operands the payload
+    /// of the left-hand operand wins.
+    [[nodiscard]] auto attributes() const { return m_attributes; }
+    [[nodiscard]] auto attribute(int id) const { return m_attributes.value(id); }
+    void setAttribute(int id, QVariant payload) { m_attributes.insert(id, std::move(payload)); }
+
     /// Return a new CSG solid with solid and empty space switched.
     [[nodiscard]] Geometry inversed() const;
 
     /// Returns a new geometry which has the transformations described
-    /// by `matrix` applied to all the polygons of this geometry.
+    /// by `matrix` applied to all the polygons of this geometry. The transform
+    /// is only recorded, and gets composed with any transform still pending.
+    /// It is applied when the polygons of the new geometry are needed.
     [[nodiscard]] Geometry transformed(const QMatrix4x4 &matrix) const;
 
+    /// Tells if this geometry has a transform that didn't get applied yet.
+    [[nodiscard]] auto isTransformPending() const { return m_transform.has_value(); }
+
+    /// Returns the bounding box of this geometry, which is computed on first
+    /// use, and then is shared by all copies of this geometry.
+    [[nodiscard]] BoundingBox boundingBox() const;
+
+    /// Tells if this geometry encloses a finite space. The polygons of such solids
+    /// face outwards, which gives them a positive volume. Inversed solids are
+    /// unbounded, still their bounding box is the finite box of their polygons.
+    /// Like the bounding box, this is computed on first use, and then is shared.
+    [[nodiscard]] bool isBounded() const;
+
+    /// Returns the BSP tree of this geometry. The tree is built on first use,
+    /// and then is shared by all copies of this geometry. It gets rebuilt if
+    /// `options` ask for a differently shaped tree. The CSG operations copy
+    /// this tree instead of building a new one. All nodes of the tree live in
+    /// one arena, therefore its subtrees are only valid as long as the tree.
+    [[nodiscard]] std::variant<std::shared_ptr<const Node>, Error> tree(const Options &options = {}) const;
+
 private:
-    QList<Polygon> m_polygons;
+    struct Cache;
+
+    QList<Polygon> m_polygons;              // not transformed by m_transform yet
+    std::optional<QMatrix4x4> m_transform;
+    Attributes m_attributes;
     Error m_error;
+    std::shared_ptr<Cache> m_cache;
+};
+
+/// A memory efficient representation of a `Geometry`. All vertices are stored
+/// in one contiguous buffer, which is referenced by a table of polygons. Planes
+/// are packed into another buffer. This avoids one allocation per polygon, and
+/// lets passes over all polygons stream through memory.
+class CompactGeometry
+{
+public:
+    /// Describes a polygon by a range of the vertex buffer.
+    struct PolygonEntry
+    {
+        quint32 firstVertex;
+        quint32 vertexCount;
+        int attribute;
+    };
+
+    CompactGeometry() = default;
+    explicit CompactGeometry(const Geometry &geometry);
+
+    [[nodiscard]] auto isEmpty() const { return m_polygons.isEmpty(); }
+    [[nodiscard]] auto size() const { return m_polygons.size(); }
+    [[nodiscard]] Error error() const { return m_error; }
+
+    [[nodiscard]] const auto &vertices() const { return m_vertices; }
+    [[nodiscard]] const auto &polygons() const { return m_polygons; }
+    [[nodiscard]] const auto &planes() const { return m_planes; }
+    [[nodiscard]] const auto &attributes() const { return m_attributes; }
+
+    /// Returns the vertices of the polygon at `index`, without copying them.
+    [[nodiscard]] std::span<const Vertex> vertices(qsizetype index) const;
+
+    /// Returns the polygon at `index`.
+    [[nodiscard]] Polygon polygon(qsizetype index) const;
+
+    /// Converts this representation back into a regular `Geometry`.
+    [[nodiscard]] Geometry toGeometry() const;
+
+    /// Returns the bounding box of all vertices.
+    [[nodiscard]] BoundingBox boundingBox() const;
+
+    /// Returns a new geometry which has the transformations described
+    /// by `matrix` applied to all vertices of this geometry.
+    [[nodiscard]] CompactGeometry transformed(const QMatrix4x4 &matrix) const;
+
+private:
+    VertexList m_vertices;
+    QVector<PolygonEntry> m_polygons;
+    QVector<Plane> m_planes;
+    Geometry::Attributes m_attributes;
+    Error m_error = Error::NoError;
+};
+
+/// A geometry whose polygons reference their vertices by index into a shared pool.
+/// Equal vertices are welded into one entry of the pool, so that a vertex shared
+/// by several polygons, like the corner of a cube, is stored only once. Vertices
+/// created by splitting a shared edge get welded too, since both polygons sharing
+/// the edge create the very same vertex.
+class IndexedGeometry
+{
+public:
+    /// Describes a polygon by a range of the index buffer.
+    struct PolygonEntry
+    {
+        quint32 firstIndex;
+        quint32 indexCount;
+        int attribute;
+    };
+
+    IndexedGeometry() = default;
+    explicit IndexedGeometry(const Geometry &geometry);
+
+    [[nodiscard]] auto isEmpty() const { return m_polygons.isEmpty(); }
+    [[nodiscard]] auto size() const { return m_polygons.size(); }
+    [[nodiscard]] Error error() const { return m_error; }
+
+    [[nodiscard]] const auto &vertices() const { return m_vertices; }
+    [[nodiscard]] const auto &indices() const { return m_indices; }
+    [[nodiscard]] const auto &polygons() const { return m_polygons; }
+    [[nodiscard]] const auto &planes() const { return m_planes; }
+    [[nodiscard]] const auto &attributes() const { return m_attributes; }
+
+    /// Returns the vertex indices of the polygon at `index`, without copying them.
+    [[nodiscard]] std::span<const quint32> indices(qsizetype index) const;
+
+    /// Returns the polygon at `index`.
+    [[nodiscard]] Polygon polygon(qsizetype index) const;
+
+    /// Converts this representation back into a regular `Geometry`.
+    [[nodiscard]] Geometry toGeometry() const;
+
+private:
+    VertexList m_vertices;
+    QVector<quint32> m_indices;
+    QVector<PolygonEntry> m_polygons;
+    QVector<Plane> m_planes;
+    Geometry::Attributes m_attributes;
+    Error m_error = Error::NoError;
 };
 
 /// Holds a node in a BSP tree. A BSP tree is built from a collection of polygons
@@ -204,38 +525,86 @@ class Node
 public:
     Node() = default;
 
-    static std::variant<Node, Error> fromPolygons(QList<Polygon> polygons,
-                                                  int limit = defaultRecursionLimit());
+    /// Constructs an empty tree whose child nodes are allocated from `resource`,
+    /// e.g. an arena that lives as long as the CSG operation using this tree.
+    explicit Node(std::pmr::memory_resource *resource) : m_resource{resource} {}
 
-    [[nodiscard]] auto plane() const { return m_plane; }
-    [[nodiscard]] auto polygons() const { return m_polygons; }
-    [[nodiscard]] auto front() const { return m_front; }
-    [[nodiscard]] auto back() const { return m_back; }
+    Node(const Node &) = default;
+    Node(Node &&) = default;
+    ~Node();
+
+    Node &operator=(const Node &) = default;
+    Node &operator=(Node &&) = default;
+
+    static std::variant<Node, Error> fromPolygons(QList<Polygon> polygons, Options options = {});
+    static std::variant<Node, Error> fromPolygons(QList<Polygon> polygons, int limit)
+    {
+        return fromPolygons(std::move(polygons), Options{.limit = limit});
+    }
+
+    [[nodiscard]] Plane plane() const;
+    [[nodiscard]] QList<Polygon> polygons() const;
+    [[nodiscard]] std::shared_ptr<Node> front() const;
+    [[nodiscard]] std::shared_ptr<Node> back() const;
+
+    /// The precision used for classifying polygons relative to the planes of
+    /// this tree. It is chosen by the `options` passed to `build()`.
+    [[nodiscard]] auto precision() const { return m_precision; }
+
+    /// The distance below which vertices are considered to be on the planes of this
+    /// tree. It is chosen by the `options` passed to `build()`. A relative tolerance
+    /// gets resolved against the bounding box of the polygons passed to `build()`.
+    [[nodiscard]] auto tolerance() const { return m_tolerance; }
+
+    /// Returns a deep copy of this tree, with its nodes allocated from `resource`.
+    [[nodiscard]] Node cloned(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
+
+    /// Returns a deep copy of this tree, with `matrix` applied to its planes and polygons.
+    /// The polygons are not partitioned again, which only gives a valid tree if `matrix`
+    /// is a similarity transform, see `isSimilarity()`. The tolerance gets scaled with it.
+    [[nodiscard]] Node transformed(const QMatrix4x4 &matrix,
+                                   std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const;
 
     /// Convert solid space to empty space and empty space to solid space.
-    void invert();
+    /// This only toggles a flag, which is honored when traversing the tree.
+    /// The polygons get flipped when they are retrieved from the tree.
+    void invert() { m_inverted = !m_inverted; }
     [[nodiscard]] Node inverted() const;
 
-    /// Recursively remove all polygons in `polygons` that are inside this BSP tree.
-    [[nodiscard]] QList<Polygon> clipPolygons(QList<Polygon> polygons) const;
+    /// Remove all polygons in `polygons` that are inside this BSP tree. If
+    /// `flipped` is set, the polygons are clipped as if they were flipped,
+    /// but the kept fragments are returned unflipped.
+    [[nodiscard]] QList<Polygon> clipPolygons(QList<Polygon> polygons, bool flipped = false) const;
 
     /// Remove all polygons in this BSP tree that are inside the other BSP tree `bsp`.
-    void clipTo(const Node &bsp);
+    /// With `options.parallel` the polygons of different nodes are clipped concurrently.
+    /// Clipping against a `Node` flattens it first; when clipping against the same tree
+    /// several times, better flatten it only once into a `FlatTree::Mode::PlanesOnly` tree.
+    void clipTo(const Node &bsp, const Options &options = {});
+    void clipTo(const FlatTree &bsp, const Options &options = {});
 
     /// Return a list of all polygons in this BSP tree.
     [[nodiscard]] QList<Polygon> allPolygons() const;
 
     /// Build a BSP tree out of `polygons`. When called on an existing tree, the
     /// new polygons are filtered down to the bottom of the tree and become new
-    /// nodes there. Each set of polygons is partitioned using the first polygon
-    /// (no heuristic is used to pick a good split).
-    Error build(QList<Polygon> polygons, int limit = defaultRecursionLimit())
+    /// nodes there. Each set of polygons is partitioned using the plane chosen
+    /// by `options.splitStrategy`; by default that's the first polygon's plane.
+    /// With `options.parallel` large subtrees are built concurrently, so the
+    /// memory resource of this node must be thread-safe then.
+    Error build(QList<Polygon> polygons, Options options = {});
+    Error build(QList<Polygon> polygons, int limit)
     {
-        return build(std::move(polygons), 0, limit);
+        return build(std::move(polygons), Options{.limit = limit});
     }
 
 private:
-    [[nodiscard]] Error build(QList<Polygon> polygons, int level, int limit);
+    friend class FlatTree;
+
+    [[nodiscard]] std::shared_ptr<Node> makeChild() const;
+    [[nodiscard]] std::shared_ptr<Node> invertedChild(const std::shared_ptr<Node> &child) const;
+
+    std::pmr::memory_resource *m_resource = std::pmr::get_default_resource();
 
     Plane m_plane;
 
@@ -243,6 +612,76 @@ private:
 
     std::shared_ptr<Node> m_front;
     std::shared_ptr<Node> m_back;
+
+    // Tells if this subtree is inverted. Inversion accumulates along the path
+    // from the root: A node is inverted if an odd number of its ancestors,
+    // including itself, are flagged. Plane, polygons and children then must
+    // be interpreted as flipped and swapped.
+    bool m_inverted = false;
+
+    Precision m_precision = Precision::Fast;
+    float m_tolerance = defaultTolerance();
+};
+
+/// A read-only copy of a BSP tree, which is stored in flat arrays instead of
+/// linked nodes: The nodes are stored in a contiguous array and refer to their
+/// children by index. Their planes are packed into a separate array, and their
+/// polygons are referenced by ranges of yet another array. Clipping against
+/// such a tree doesn't chase pointers, and mostly touches the packed planes.
+class FlatTree
+{
+public:
+    static constexpr auto NoChild = ~quint32{0};
+
+    struct Entry
+    {
+        quint32 front = NoChild;
+        quint32 back = NoChild;
+        quint32 firstPolygon = 0;
+        quint32 polygonCount = 0;
+        bool inverted = false; ///< the polygons must be flipped
+    };
+
+    /// Tells what gets copied from the nodes. Trees which are only used
+    /// for clipping other polygons only need the planes of their nodes.
+    enum class Mode
+    {
+        Full,
+        PlanesOnly,
+    };
+
+    FlatTree() = default;
+    explicit FlatTree(const Node &node, Mode mode = Mode::Full);
+
+    [[nodiscard]] auto isEmpty() const { return m_entries.isEmpty(); }
+    [[nodiscard]] auto entries() const { return m_entries; }
+    [[nodiscard]] auto planes() const { return m_planes; }
+    [[nodiscard]] auto precision() const { return m_precision; }
+    [[nodiscard]] auto tolerance() const { return m_tolerance; }
+
+    /// Remove all polygons in `polygons` that are inside this BSP tree. With
+    /// `options.parallel` large lists are clipped in concurrent batches, without
+    /// changing the order of the result.
+    [[nodiscard]] QList<Polygon> clipPolygons(QList<Polygon> polygons, const Options &options = {}) const;
+
+    /// Return a list of all polygons in this BSP tree, which is empty
+    /// for trees built with `Mode::PlanesOnly`.
+    [[nodiscard]] QList<Polygon> allPolygons() const;
+
+private:
+    friend class Node;
+
+    /// Like the public `clipPolygons()`, but `flipped` tells that all `polygons`
+    /// must be flipped first, without actually flipping them.
+    [[nodiscard]] QList<Polygon> clipPolygons(QList<Polygon> polygons, bool flipped,
+                                              const Options &options) const;
+
+    // Unlike Qt5's `QList`, `QVector` stores entries and planes in one block.
+    QVector<Entry> m_entries;
+    QVector<Plane> m_planes;
+    QList<Polygon> m_polygons;
+    Precision m_precision = Precision::Fast;
+    float m_tolerance = defaultTolerance();
 };
 
 /// Construct an axis-aligned solid cuboid.
@@ -259,12 +698,22 @@ private:
 [[nodiscard]] Geometry cylinder(QVector3D start, QVector3D end, float radius = 1, float slices = 16);
 [[nodiscard]] Geometry cylinder(QVector3D center = {}, float height = 2, float radius = 1, float slices = 16);
 
+/// The functions constructing primitives return shared copies of the geometries
+/// they have constructed before for the same parameters. These copies also share
+/// their BSP trees. This limits the number of polygons kept in that cache, which
+/// includes the polygons of these trees. The least recently used primitives are
+/// dropped first. Zero disables the cache.
+void setPrimitiveCacheLimit(int polygonCount);
+[[nodiscard]] int primitiveCacheLimit();
+
 /// Constructs a single geometry from simple expression:
 ///
 /// "cube()" produces a simple cube.
 /// "sphere(r=1.3)" produces a sphere of radius 1.3.
 ///
-/// See `testParseGeometry()` for more examples.
+/// See `testParseGeometry()` for more examples. Expressions can also combine
+/// and transform geometries, see `Program` for the full expression language.
+/// Compiled expressions are cached, so parsing the same expression again is cheap.
 [[nodiscard]] Geometry parseGeometry(QString expression);
 
 /// Return a new CSG solid representing space in either this solid or in the
@@ -281,11 +730,19 @@ private:
 ///          |       |            |       |
 ///          +-------+            +-------+
 ///
-[[nodiscard]] Geometry merge(Geometry a, Geometry b, int limit = defaultRecursionLimit());
+[[nodiscard]] Geometry merge(Geometry a, Geometry b, Options options = {});
+[[nodiscard]] inline auto merge(Geometry a, Geometry b, int limit)
+{ return merge(std::move(a), std::move(b), Options{.limit = limit}); }
 
 [[nodiscard]] inline auto unite(Geometry a, Geometry b) { return merge(std::move(a), std::move(b)); }
 [[nodiscard]] inline auto operator|(Geometry a, Geometry b) { return merge(std::move(a), std::move(b)); }
 
+/// Return a new CSG solid representing space in any of the `geometries`.
+/// The geometries are united pairwise in a balanced tree of operations,
+/// and independent pairs are united concurrently.
+[[nodiscard]] Geometry merge(QList<Geometry> geometries, Options options = {});
+[[nodiscard]] inline auto unite(QList<Geometry> geometries) { return merge(std::move(geometries)); }
+
 /// Return a new CSG solid representing space in this solid but not in the
 /// solid `csg`. Neither this solid nor the solid `csg` are modified.
 ///
@@ -300,11 +757,19 @@ private:
 ///          |       |
 ///          +-------+
 ///
-[[nodiscard]] Geometry subtract(Geometry a, Geometry b, int limit = defaultRecursionLimit());
+[[nodiscard]] Geometry subtract(Geometry a, Geometry b, Options options = {});
+[[nodiscard]] inline auto subtract(Geometry a, Geometry b, int limit)
+{ return subtract(std::move(a), std::move(b), Options{.limit = limit}); }
 
 [[nodiscard]] inline auto difference(Geometry a, Geometry b) { return subtract(std::move(a), std::move(b)); }
 [[nodiscard]] inline auto operator-(Geometry a, Geometry b) { return subtract(std::move(a), std::move(b)); }
 
+/// Return a new CSG solid representing space in `a`, but not in any of the
+/// `geometries`. The `geometries` are united first, just like `merge()` does.
+[[nodiscard]] Geometry subtract(Geometry a, QList<Geometry> geometries, Options options = {});
+[[nodiscard]] inline auto difference(Geometry a, QList<Geometry> geometries)
+{ return subtract(std::move(a), std::move(geometries)); }
+
 /// Return a new CSG solid representing space both this solid and in the
 /// solid `csg`. Neither this solid nor the solid `csg` are modified.
 ///
@@ -319,15 +784,66 @@ private:
 ///          |       |
 ///          +-------+
 ///
-[[nodiscard]] Geometry intersect(Geometry a, Geometry b, int limit = defaultRecursionLimit());
+[[nodiscard]] Geometry intersect(Geometry a, Geometry b, Options options = {});
+[[nodiscard]] inline auto intersect(Geometry a, Geometry b, int limit)
+{ return intersect(std::move(a), std::move(b), Options{.limit = limit}); }
 
 [[nodiscard]] inline auto intersection(Geometry a, Geometry b) { return intersect(std::move(a), std::move(b)); }
 [[nodiscard]] inline auto operator&(Geometry a, Geometry b) { return intersect(std::move(a), std::move(b)); }
 
+/// Return a new CSG solid representing space in all of the `geometries`.
+/// The geometries are intersected pairwise in a balanced tree of operations,
+/// and independent pairs are intersected concurrently.
+[[nodiscard]] Geometry intersect(QList<Geometry> geometries, Options options = {});
+[[nodiscard]] inline auto intersection(QList<Geometry> geometries) { return intersect(std::move(geometries)); }
+
+/// The result of a CSG `operation`, which gets updated cheaply when one of its
+/// operands changes: The result is kept as the fragments each polygon of the
+/// operands got clipped into. When an operand is replaced, only the polygons
+/// of the other operand whose bounds intersect the old or the new region of
+/// the replaced operand get clipped again, just like the polygons of the new
+/// operand. The result is computed like with `Options::overlapCulling`.
+class IncrementalOperation
+{
+public:
+    IncrementalOperation(Operation operation, Geometry lhs, Geometry rhs, Options options = {});
+
+    [[nodiscard]] auto operation() const { return m_operation; }
+    [[nodiscard]] auto lhs() const { return m_lhs.geometry; }
+    [[nodiscard]] auto rhs() const { return m_rhs.geometry; }
+
+    /// Returns the current result of the operation.
+    [[nodiscard]] Geometry result() const;
+
+    /// Replaces the left-hand operand, and updates the result.
+    void setLhs(Geometry lhs);
+
+    /// Replaces the right-hand operand, and updates the result.
+    void setRhs(Geometry rhs);
+
+private:
+    struct Operand
+    {
+        Geometry geometry;
+        QVector<BoundingBox> bounds;
+        QVector<QList<Polygon>> fragments;
+        bool bounded = true;
+    };
+
+    void update(Operand *changed, const BoundingBox &region);
+
+    Operation m_operation;
+    Options m_options;
+    Operand m_lhs;
+    Operand m_rhs;
+    Error m_error = Error::NoError;
+};
+
 [[nodiscard]] inline Vertex operator*(const QMatrix4x4 &m, const Vertex &v) { return v.transformed(m); }
 [[nodiscard]] inline Polygon operator*(const QMatrix4x4 &m, const Polygon &p) { return p.transformed(m); }
 [[nodiscard]] inline Geometry operator*(const QMatrix4x4 &m, const Geometry &g) { return g.transformed(m); }
 
+QDebug operator<<(QDebug debug, BoundingBox box);
 QDebug operator<<(QDebug debug, Geometry geometry);
 QDebug operator<<(QDebug debug, Plane plane);
 QDebug operator<<(QDebug debug, Polygon polygon);
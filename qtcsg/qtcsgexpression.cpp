@@ -0,0 +1,728 @@
+/* QtCSG provides Constructive Solid Geometry (CSG) for Qt
+ * Copyright Ⓒ 2023 Mathias Hasselmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "qtcsgexpression.h"
+
+#include "qtcsgmath.h"
+#include "qtcsgutils.h"
+
+#include <QCache>
+#include <QLoggingCategory>
+#include <QMutex>
+
+#include <optional>
+
+namespace QtCSG {
+
+namespace {
+
+Q_LOGGING_CATEGORY(lcExpression, "qtcsg.expression");
+
+enum class Kind {
+    Primitive,
+    Union,
+    Difference,
+    Intersection,
+    Translate,
+    Rotate,
+    Scale,
+};
+
+using ArgumentTypeMap = QMap<QString, QList<int>>;
+
+struct Signature
+{
+    Kind kind;
+    ArgumentTypeMap arguments;
+    int minimumOperands = 0;
+    int maximumOperands = 0; // negative values mean unlimited
+};
+
+const QMap<QString, Signature> &signatures()
+{
+    static constexpr auto scalarType = qMetaTypeId<float>();
+    static constexpr auto vectorType = qMetaTypeId<QVector3D>();
+
+    static const auto s_signatures = QMap<QString, Signature> {
+        {"cube", {Kind::Primitive, {{"center", {vectorType}},
+                                    {"r",      {scalarType, vectorType}}}}},
+
+        {"cylinder", {Kind::Primitive, {{"start",  {vectorType}},
+                                        {"center", {vectorType}},
+                                        {"end",    {vectorType}},
+                                        {"h",      {scalarType}},
+                                        {"r",      {scalarType}},
+                                        {"slices", {scalarType}}}}},
+
+        {"sphere", {Kind::Primitive, {{"center", {vectorType}},
+                                      {"r",      {scalarType}},
+                                      {"slices", {scalarType}},
+                                      {"stacks", {scalarType}}}}},
+
+        {"union",        {Kind::Union,        {}, 1, -1}},
+        {"difference",   {Kind::Difference,   {}, 2, -1}},
+        {"intersection", {Kind::Intersection, {}, 1, -1}},
+
+        {"translate", {Kind::Translate, {{"v",     {vectorType}}}, 1, 1}},
+        {"rotate",    {Kind::Rotate,    {{"angle", {scalarType}},
+                                         {"axis",  {vectorType}}}, 1, 1}},
+        {"scale",     {Kind::Scale,     {{"v",     {scalarType, vectorType}}}, 1, 1}},
+    };
+
+    return s_signatures;
+}
+
+/// Describes what kind of thing was called in diagnostic messages.
+const char *noun(Kind kind)
+{
+    return kind == Kind::Primitive ? "primitive" : "operation";
+}
+
+/// A single number: Either a constant, or a variable bound during evaluation.
+struct Term
+{
+    float constant = 0;
+    QString variable;
+};
+
+/// An argument value: A single term for scalars and variables, three terms for vectors.
+struct Value
+{
+    QVector<Term> terms;
+
+    /// The type of this value, or `std::nullopt` if it is only known during evaluation.
+    [[nodiscard]] std::optional<int> type() const
+    {
+        if (terms.size() == 3)
+            return qMetaTypeId<QVector3D>();
+        if (terms.first().variable.isEmpty())
+            return qMetaTypeId<float>();
+
+        return {};
+    }
+};
+
+bool isNameCharacter(QChar ch)
+{
+    return ch.unicode() >= u'a' && ch.unicode() <= u'z';
+}
+
+bool isVariableCharacter(QChar ch)
+{
+    return ch.isLetterOrNumber() || ch == QChar{'_'};
+}
+
+struct EnsureValue
+{
+    const QVariantMap &arguments;
+
+    template<typename T>
+    T operator()(const QString &key, T defaultValue = {}) const
+    {
+        return (*this)(arguments.constFind(key), std::move(defaultValue));
+    }
+
+    template<typename T>
+    T operator()(const QVariantMap::ConstIterator &iter, T defaultValue = {}) const
+    {
+        if (iter != arguments.constEnd())
+            return qvariant_cast<T>(*iter);
+
+        return defaultValue;
+    }
+};
+
+Geometry createGeometry(QStringView primitiveName, QVariantMap arguments)
+{
+    const auto value = EnsureValue{arguments};
+
+    if (primitiveName == u"cube") {
+        const auto radius = arguments.value("r", 1.0f);
+
+        if (radius.userType() == qMetaTypeId<QVector3D>()) {
+            return cube(value("center", QVector3D{}),
+                        qvariant_cast<QVector3D>(radius));
+        }
+
+        return cube(value("center", QVector3D{}), radius.toFloat());
+    }
+
+    if (primitiveName == u"cylinder") {
+        const auto start = arguments.constFind("start");
+        const auto end = arguments.constFind("end");
+
+        if (start != arguments.constEnd() || end != arguments.constEnd()) {
+            static const auto conflicts = std::array<QString, 2>{"center", "h"};
+
+            for (const auto &conflictingName: conflicts) {
+                if (arguments.contains(conflictingName)) {
+                    qCWarning(lcExpression,
+                              R"(Argument "%ls" conflicts with arguments )"
+                              R"("start" and "end" of %ls primitive)",
+                              qUtf16Printable(conflictingName),
+                              qUtf16Printable(primitiveName.toString()));
+
+                    return Geometry{Error::FileFormatError};
+                }
+            }
+
+            return cylinder(value(start,    QVector3D{}),
+                            value(end,      QVector3D{}),
+                            value("r",      1.0f),
+                            value("slices", 16));
+        } else {
+            return cylinder(value("center", QVector3D{}),
+                            value("h",      2.0f),
+                            value("r",      1.0f),
+                            value("slices", 16));
+        }
+    }
+
+    if (primitiveName == u"sphere") {
+        return sphere(value("center",   QVector3D{}),
+                      value("r",        1.0f),
+                      value("slices",   16),
+                      value("stacks",   8));
+    }
+
+    qCCritical(lcExpression, R"(Unsupported primitive type: "%ls")",
+               qUtf16Printable(primitiveName.toString()));
+
+    return Geometry{Error::FileFormatError};
+}
+
+} // namespace
+
+struct Program::Operation
+{
+    Kind kind;
+    QString name;
+    QMap<QString, Value> arguments;
+    QList<std::shared_ptr<const Operation>> operands;
+
+    [[nodiscard]] Geometry evaluate(const Bindings &bindings, const Options &options) const;
+
+private:
+    [[nodiscard]] std::optional<QVariantMap> resolveArguments(const Bindings &bindings) const;
+    [[nodiscard]] Geometry evaluateOperands(const Bindings &bindings, const Options &options) const;
+};
+
+class Program::Compiler
+{
+public:
+    explicit Compiler(QStringView text)
+        : m_text{std::move(text)}
+    {}
+
+    [[nodiscard]] Program compile();
+
+private:
+    [[nodiscard]] std::shared_ptr<const Operation> parseCall();
+    [[nodiscard]] bool parseValue(Value *value);
+    [[nodiscard]] bool parseTerm(Term *term);
+    [[nodiscard]] QStringView parseName();
+
+    [[nodiscard]] bool atEnd() const { return m_position >= m_text.size(); }
+    [[nodiscard]] QChar peek() const { return atEnd() ? QChar{} : m_text.at(m_position); }
+    [[nodiscard]] bool consume(char expected);
+    void skipSpace();
+
+    [[nodiscard]] QStringView argumentList(qsizetype start) const;
+    [[nodiscard]] QStringView argument(qsizetype start) const;
+
+    QStringView m_text;
+    qsizetype m_position = 0;
+    QStringList m_variables;
+    Error m_error = Error::NoError;
+};
+
+Program Program::Compiler::compile()
+{
+    auto program = Program{};
+
+    // Only calls are expressions; anything else, like a file name, is silently rejected.
+    const auto name = parseName();
+
+    if (name.isEmpty() || peek() != QChar{'('}) {
+        program.m_error = Error::FileFormatError;
+        return program;
+    }
+
+    m_position = 0;
+
+    if (auto root = parseCall()) {
+        skipSpace();
+
+        if (atEnd()) {
+            std::sort(m_variables.begin(), m_variables.end());
+            program.m_root = std::move(root);
+            program.m_variables = std::move(m_variables);
+            return program;
+        }
+
+        qCWarning(lcExpression, R"(Unexpected expression: "%ls")",
+                  qUtf16Printable(m_text.mid(m_position).toString()));
+        m_error = Error::FileFormatError;
+    }
+
+    program.m_error = m_error;
+    return program;
+}
+
+std::shared_ptr<const Program::Operation> Program::Compiler::parseCall()
+{
+    skipSpace();
+
+    const auto name = parseName().toString();
+    const auto signature = signatures().constFind(name);
+
+    if (signature == signatures().constEnd()) {
+        qCWarning(lcExpression, R"(Unsupported primitive: "%ls")", qUtf16Printable(name));
+        m_error = Error::NotSupportedError;
+        return {};
+    }
+
+    const auto open = m_position;
+
+    if (!consume('(')) {
+        qCWarning(lcExpression, R"(Unexpected expression: "%ls")",
+                  qUtf16Printable(argument(open).toString()));
+        m_error = Error::FileFormatError;
+        return {};
+    }
+
+    auto operation = std::make_shared<Operation>();
+    operation->kind = signature->kind;
+    operation->name = name;
+
+    skipSpace();
+
+    for (auto index = 0; !consume(')'); ++index) {
+        const auto start = m_position;
+
+        const auto fail = [this, index, open, start] {
+            if (index == 0) {
+                qCWarning(lcExpression, R"(Invalid argument list: "%ls")",
+                          qUtf16Printable(argumentList(open).toString()));
+            } else {
+                qCWarning(lcExpression, R"(Unexpected expression: "%ls")",
+                          qUtf16Printable(argument(start).toString()));
+            }
+
+            m_error = Error::FileFormatError;
+            return nullptr;
+        };
+
+        const auto argumentName = parseName().toString();
+
+        if (argumentName.isEmpty())
+            return fail();
+
+        skipSpace();
+
+        if (peek() == QChar{'('}) {
+            m_position = start;
+
+            auto operand = parseCall();
+
+            if (!operand)
+                return {};
+
+            operation->operands.append(std::move(operand));
+        } else if (consume('=')) {
+            auto value = Value{};
+
+            skipSpace();
+
+            if (!parseValue(&value))
+                return fail();
+
+            if (operation->arguments.contains(argumentName)) {
+                qCWarning(lcExpression, R"(Duplicate argument "%ls")", qUtf16Printable(argumentName));
+                m_error = Error::FileFormatError;
+                return {};
+            }
+
+            const auto valueSpec = signature->arguments.constFind(argumentName);
+
+            if (valueSpec == signature->arguments.constEnd()) {
+                qCWarning(lcExpression, R"(Unsupported argument "%ls" for %ls %s)",
+                          qUtf16Printable(argumentName), qUtf16Printable(name),
+                          noun(signature->kind));
+                m_error = Error::FileFormatError;
+                return {};
+            }
+
+            if (const auto type = value.type(); type && !valueSpec->contains(*type)) {
+                qCWarning(lcExpression, R"(Unsupported value type for argument "%ls" of %ls %s)",
+                          qUtf16Printable(argumentName), qUtf16Printable(name),
+                          noun(signature->kind));
+                m_error = Error::FileFormatError;
+                return {};
+            }
+
+            operation->arguments.insert(argumentName, std::move(value));
+        } else {
+            return fail();
+        }
+
+        skipSpace();
+
+        if (consume(',')) {
+            skipSpace();
+        } else if (peek() != QChar{')'}) {
+            return fail();
+        }
+    }
+
+    const auto operandCount = operation->operands.size();
+
+    // A difference with nothing to subtract would silently return its first operand.
+    if (operation->kind == Kind::Difference && operandCount < signature->minimumOperands) {
+        qCWarning(lcExpression, R"(%ls needs at least two operands)", qUtf16Printable(name));
+        m_error = Error::FileFormatError;
+        return {};
+    }
+
+    if (operandCount < signature->minimumOperands
+            || (signature->maximumOperands >= 0 && operandCount > signature->maximumOperands)) {
+        qCWarning(lcExpression, R"(Unexpected number of operands for %ls %s)",
+                  qUtf16Printable(name), noun(signature->kind));
+        m_error = Error::FileFormatError;
+        return {};
+    }
+
+    return operation;
+}
+
+bool Program::Compiler::parseValue(Value *value)
+{
+    if (!consume('[')) {
+        value->terms.resize(1);
+        return parseTerm(&value->terms.first());
+    }
+
+    value->terms.resize(3);
+
+    for (auto i = 0; i < 3; ++i) {
+        skipSpace();
+
+        if (!parseTerm(&value->terms[i]))
+            return false;
+
+        skipSpace();
+
+        if (!consume(i < 2 ? ',' : ']'))
+            return false;
+    }
+
+    return true;
+}
+
+bool Program::Compiler::parseTerm(Term *term)
+{
+    const auto start = m_position;
+
+    if (consume('$')) {
+        while (!atEnd() && isVariableCharacter(peek()))
+            ++m_position;
+
+        term->variable = m_text.mid(start + 1, m_position - start - 1).toString();
+
+        if (term->variable.isEmpty())
+            return false;
+
+        if (!m_variables.contains(term->variable))
+            m_variables.append(term->variable);
+
+        return true;
+    }
+
+    if (peek() == QChar{'+'} || peek() == QChar{'-'})
+        ++m_position;
+
+    const auto digitsStart = m_position;
+
+    while (!atEnd() && peek().isDigit())
+        ++m_position;
+
+    if (m_position == digitsStart)
+        return false;
+
+    if (consume('.')) {
+        while (!atEnd() && peek().isDigit())
+            ++m_position;
+    }
+
+    // QStringView::toFloat() is not available before Qt6.
+    term->constant = m_text.mid(start, m_position - start).toString().toFloat();
+    return true;
+}
+
+QStringView Program::Compiler::parseName()
+{
+    const auto start = m_position;
+
+    while (!atEnd() && isNameCharacter(peek()))
+        ++m_position;
+
+    return m_text.mid(start, m_position - start);
+}
+
+bool Program::Compiler::consume(char expected)
+{
+    if (peek() != QChar{expected})
+        return false;
+
+    ++m_position;
+    return true;
+}
+
+void Program::Compiler::skipSpace()
+{
+    while (!atEnd() && peek().isSpace())
+        ++m_position;
+}
+
+/// Returns the text from `start` up to, and including the matching closing parenthesis.
+QStringView Program::Compiler::argumentList(qsizetype start) const
+{
+    auto depth = 0;
+
+    for (auto i = start; i < m_text.size(); ++i) {
+        if (m_text.at(i) == QChar{'('}) {
+            ++depth;
+        } else if (m_text.at(i) == QChar{')'} && --depth == 0) {
+            return m_text.mid(start, i - start + 1);
+        }
+    }
+
+    return m_text.mid(start);
+}
+
+/// Returns the text from `start` up to the end of the current argument.
+QStringView Program::Compiler::argument(qsizetype start) const
+{
+    auto depth = 0;
+    auto i = start;
+
+    for (; i < m_text.size(); ++i) {
+        const auto ch = m_text.at(i);
+
+        if (ch == QChar{'('} || ch == QChar{'['}) {
+            ++depth;
+        } else if (ch == QChar{')'} || ch == QChar{']'}) {
+            if (--depth < 0)
+                break;
+        } else if (ch == QChar{','} && depth == 0) {
+            break;
+        }
+    }
+
+    return m_text.mid(start, i - start).trimmed();
+}
+
+std::optional<QVariantMap> Program::Operation::resolveArguments(const Bindings &bindings) const
+{
+    const auto &argumentTypes = signatures().constFind(name)->arguments;
+    auto resolvedArguments = QVariantMap{};
+
+    const auto resolve = [&bindings](const Term &term) -> std::optional<QVariant> {
+        if (term.variable.isEmpty())
+            return QVariant{term.constant};
+
+        const auto binding = bindings.constFind(term.variable);
+
+        if (binding == bindings.constEnd()) {
+            qCWarning(lcExpression, R"(Unbound variable "$%ls")", qUtf16Printable(term.variable));
+            return {};
+        }
+
+        if (binding->userType() == qMetaTypeId<QVector3D>())
+            return *binding;
+
+        auto isNumber = false;
+
+        if (const auto number = binding->toFloat(&isNumber); isNumber)
+            return QVariant{number};
+
+        return QVariant{};
+    };
+
+    for (auto it = arguments.constBegin(); it != arguments.constEnd(); ++it) {
+        auto value = QVariant{};
+
+        if (it->terms.size() == 3) {
+            auto components = std::array<float, 3>{};
+            auto isVector = true;
+
+            for (auto i = 0; i < 3; ++i) {
+                const auto component = resolve(it->terms[i]);
+
+                if (!component)
+                    return {};
+
+                isVector &= component->userType() == qMetaTypeId<float>();
+                components[static_cast<std::size_t>(i)] = qvariant_cast<float>(*component);
+            }
+
+            if (isVector)
+                value = QVector3D{components[0], components[1], components[2]};
+        } else if (auto term = resolve(it->terms.first())) {
+            value = std::move(*term);
+        } else {
+            return {};
+        }
+
+        if (!argumentTypes.value(it.key()).contains(value.userType())) {
+            qCWarning(lcExpression, R"(Unsupported value type for argument "%ls" of %ls %s)",
+                      qUtf16Printable(it.key()), qUtf16Printable(name), noun(kind));
+            return {};
+        }
+
+        resolvedArguments.insert(it.key(), std::move(value));
+    }
+
+    return resolvedArguments;
+}
+
+Geometry Program::Operation::evaluateOperands(const Bindings &bindings, const Options &options) const
+{
+    auto geometries = std::vector<Geometry>(static_cast<std::size_t>(operands.size()));
+    auto tasks = Utils::TaskGroup{};
+
+    for (auto i = 0U; i < geometries.size(); ++i) {
+        tasks.run([this, &geometries, &bindings, &options, i] {
+            geometries[i] = operands[static_cast<qsizetype>(i)]->evaluate(bindings, options);
+        });
+    }
+
+    tasks.wait();
+
+    for (const auto &geometry: geometries) {
+        if (geometry.error() != Error::NoError)
+            return Geometry{geometry.error()};
+    }
+
+    auto operandList = QList<Geometry>{geometries.begin(), geometries.end()};
+
+    switch (kind) {
+    case Kind::Union:
+        return merge(std::move(operandList), options);
+
+    case Kind::Difference: {
+        const auto first = operandList.takeFirst();
+        return subtract(first, std::move(operandList), options);
+    }
+
+    case Kind::Intersection:
+        return intersect(std::move(operandList), options);
+
+    case Kind::Primitive:
+    case Kind::Translate:
+    case Kind::Rotate:
+    case Kind::Scale:
+        break;
+    }
+
+    return operandList.first();
+}
+
+Geometry Program::Operation::evaluate(const Bindings &bindings, const Options &options) const
+{
+    const auto resolvedArguments = resolveArguments(bindings);
+
+    if (!resolvedArguments)
+        return Geometry{Error::FileFormatError};
+
+    const auto value = EnsureValue{*resolvedArguments};
+
+    switch (kind) {
+    case Kind::Primitive:
+        return createGeometry(name, *resolvedArguments);
+
+    case Kind::Union:
+    case Kind::Difference:
+    case Kind::Intersection:
+        return evaluateOperands(bindings, options);
+
+    case Kind::Translate:
+        return evaluateOperands(bindings, options).transformed(
+                    translation(value("v", QVector3D{})));
+
+    case Kind::Rotate:
+        return evaluateOperands(bindings, options).transformed(
+                    rotation(value("angle", 0.0f), value("axis", QVector3D{0, 0, 1})));
+
+    case Kind::Scale:
+        if (const auto factor = resolvedArguments->value("v", 1.0f);
+                factor.userType() == qMetaTypeId<QVector3D>()) {
+            return evaluateOperands(bindings, options).transformed(
+                        scale(qvariant_cast<QVector3D>(factor)));
+        } else {
+            return evaluateOperands(bindings, options).transformed(
+                        scale(factor.toFloat()));
+        }
+    }
+
+    return Geometry{Error::NotSupportedError};
+}
+
+Program Program::compile(QStringView expression)
+{
+    return Compiler{std::move(expression)}.compile();
+}
+
+Geometry Program::evaluate(const Bindings &bindings, const Options &options) const
+{
+    if (m_error != Error::NoError)
+        return Geometry{m_error};
+    if (!m_root)
+        return {};
+
+    return m_root->evaluate(bindings, options);
+}
+
+Program compileExpression(const QString &expression)
+{
+    struct ProgramCache
+    {
+        QMutex mutex;
+        QCache<QString, Program> programs{256};
+    };
+
+    static auto s_cache = ProgramCache{};
+
+    {
+        const auto locker = QMutexLocker{&s_cache.mutex};
+
+        if (const auto program = s_cache.programs.object(expression))
+            return *program;
+    }
+
+    // Compile without holding the lock, so that different
+    // expressions can get compiled concurrently.
+    auto program = Program::compile(expression);
+
+    const auto locker = QMutexLocker{&s_cache.mutex};
+    s_cache.programs.insert(expression, new Program{program});
+
+    return program;
+}
+
+} // namespace QtCSG
@@ -0,0 +1,76 @@
+/* QtCSG provides Constructive Solid Geometry (CSG) for Qt
+ * Copyright Ⓒ 2023 Mathias Hasselmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef QTCSG_QTCSGEXPRESSION_H
+#define QTCSG_QTCSGEXPRESSION_H
+
+#include "qtcsg.h"
+
+#include <QHash>
+#include <QStringList>
+#include <QVariant>
+
+namespace QtCSG {
+
+/// A CSG expression that got compiled into a tree of operations. The program can
+/// be evaluated many times, with different values for its variables:
+///
+///     difference(cube(r=$size),
+///                translate(v=[0,0,$depth], cylinder(r=$radius, h=4)))
+///
+/// Primitives accept the arguments described for `parseGeometry()`. Values are
+/// numbers, vectors like `[1,2,3]`, or variables like `$size`. The operations
+/// `union()`, `difference()` and `intersection()` combine one or more operands.
+/// The transforms `translate(v=[x,y,z])`, `rotate(angle=a, axis=[x,y,z])` and
+/// `scale(v=s)` or `scale(v=[x,y,z])` take exactly one operand.
+class Program
+{
+public:
+    /// Values for the variables of a program. Values must be numbers or `QVector3D`.
+    using Bindings = QHash<QString, QVariant>;
+
+    Program() = default;
+
+    /// Compiles `expression`. Check `error()` to find out if this succeeded.
+    [[nodiscard]] static Program compile(QStringView expression);
+
+    [[nodiscard]] Error error() const { return m_error; }
+
+    /// The names of all variables used by this program, without leading `$`.
+    [[nodiscard]] QStringList variables() const { return m_variables; }
+
+    /// Builds the geometry described by this program, with variables taken from
+    /// `bindings`. Independent operands get evaluated concurrently.
+    [[nodiscard]] Geometry evaluate(const Bindings &bindings = {}, const Options &options = {}) const;
+
+private:
+    class Compiler;
+    struct Operation;
+
+    std::shared_ptr<const Operation> m_root;
+    QStringList m_variables;
+    Error m_error = Error::NoError;
+};
+
+/// Like `Program::compile()`, but programs get cached, so that
+/// expressions get compiled only once.
+[[nodiscard]] Program compileExpression(const QString &expression);
+
+} // namespace QtCSG
+
+#endif // QTCSG_QTCSGEXPRESSION_H
@@ -1,12 +1,15 @@
 #include "qtcsgio.h"
 
 #include "qtcsgmath.h"
+#include "qtcsgutils.h"
 
 #include <QFile>
 #include <QFileInfo>
 #include <QLoggingCategory>
 #include <QTextStream>
 
+#include <unordered_map>
+
 namespace QtCSG {
 
 namespace {
@@ -20,25 +23,25 @@ concept HasEmplaceBack = requires(T *object) {
     object->emplaceBack(typename T::value_type{});
 };
 
-template<class T, typename... Args>
-void emplaceBack(QList<T> &list, Args... args)
+template<class Container, typename... Args>
+void emplaceBack(Container &list, Args... args)
 {
-    static_assert(HasEmplaceBack<QList<T>>
+    static_assert(HasEmplaceBack<Container>
                   || QT_VERSION_MAJOR < 6);
 
-    if constexpr (HasEmplaceBack<QList<T>>) {
+    if constexpr (HasEmplaceBack<Container>) {
         list.emplaceBack(std::forward<Args>(args)...);
     } else {
-        list.append(T{std::forward<Args>(args)...});
+        list.append(typename Container::value_type{std::forward<Args>(args)...});
     }
 }
 
 #else
 
-template<class T, typename... Args>
-void emplaceBack(QList<T> &list, Args... args)
+template<class Container, typename... Args>
+void emplaceBack(Container &list, Args... args)
 {
-    list.append(T{std::forward<Args>(args)...});
+    list.append(typename Container::value_type{std::forward<Args>(args)...});
 }
 
 #endif
@@ -146,7 +149,7 @@ Geometry OffFileFormat::readGeometry(QIODevice *device) const
                     }
                 }
 
-                auto outline = QList<Vertex>{};
+                auto outline = VertexList{};
                 outline.reserve(indices.size());
 
                 for (auto j = 0; j < n; ++j) {
@@ -184,8 +187,9 @@ Error OffFileFormat::writeGeometry(Geometry geometry, QIODevice *device) const
 {
     auto faces = std::vector<std::vector<std::size_t>>{};
     auto vertices = std::vector<QVector3D>{};
+    auto vertexIndices = std::unordered_map<QVector3D, std::size_t, Utils::PositionHash>{};
 
-    const auto polygons = geometry.polygons();
+    const auto &polygons = geometry.polygons();
     faces.reserve(polygons.size());
 
     for (const auto &p: polygons) {
@@ -194,13 +198,12 @@ Error OffFileFormat::writeGeometry(Geometry geometry, QIODevice *device) const
 
         for (const auto &v: p.vertices()) {
             const auto p = v.position();
+            const auto [it, inserted] = vertexIndices.try_emplace(p, vertices.size());
 
-            auto it = std::find(vertices.begin(), vertices.end(), p);
-
-            if (it == vertices.end())
-                it = vertices.emplace(vertices.end(), p.x(), p.y(), p.z());
+            if (inserted)
+                vertices.emplace_back(p);
 
-            faces.back().emplace_back(it - vertices.begin());
+            faces.back().emplace_back(it->second);
         }
     }
 
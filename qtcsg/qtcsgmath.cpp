@@ -64,4 +64,30 @@ QMatrix4x4 findRotation(const QMatrix4x4 &matrix)
     };
 }
 
+bool isAffine(const QMatrix4x4 &matrix)
+{
+    return matrix(3, 0) == 0 && matrix(3, 1) == 0 && matrix(3, 2) == 0 && matrix(3, 3) == 1;
+}
+
+bool isSimilarity(const QMatrix4x4 &matrix)
+{
+    if (!isAffine(matrix))
+        return false;
+
+    const auto x = QVector3D{matrix(0, 0), matrix(1, 0), matrix(2, 0)};
+    const auto y = QVector3D{matrix(0, 1), matrix(1, 1), matrix(2, 1)};
+    const auto z = QVector3D{matrix(0, 2), matrix(1, 2), matrix(2, 2)};
+
+    // The axes must be orthogonal, and must have the same non-zero length.
+    const auto squaredScale = x.lengthSquared();
+    const auto epsilon = 1e-5f * squaredScale;
+
+    return squaredScale > 0
+            && std::abs(y.lengthSquared() - squaredScale) <= epsilon
+            && std::abs(z.lengthSquared() - squaredScale) <= epsilon
+            && std::abs(dotProduct(x, y)) <= epsilon
+            && std::abs(dotProduct(y, z)) <= epsilon
+            && std::abs(dotProduct(z, x)) <= epsilon;
+}
+
 } // namespace QtCSG
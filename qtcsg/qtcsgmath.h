@@ -94,6 +94,13 @@ template<typename... Args>
 [[nodiscard]] QVector3D  findScale      (const QMatrix4x4 &matrix);
 [[nodiscard]] QMatrix4x4 findRotation   (const QMatrix4x4 &matrix);
 
+/// Tells if `matrix` maps positions without perspective division.
+[[nodiscard]] bool       isAffine       (const QMatrix4x4 &matrix);
+
+/// Tells if `matrix` only rotates, mirrors, translates, and uniformly scales.
+/// Such transforms keep angles, and therefore also the partitions of BSP trees.
+[[nodiscard]] bool       isSimilarity   (const QMatrix4x4 &matrix);
+
 } // namespace QtCSG
 
 #endif // QTCSGMATH_H
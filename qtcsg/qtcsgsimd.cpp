@@ -0,0 +1,397 @@
+/* QtCSG provides Constructive Solid Geometry (CSG) for Qt
+ * Copyright Ⓒ 2023 Mathias Hasselmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#include "qtcsgsimd.h"
+
+#include "qtcsgmath.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define QTCSG_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace QtCSG::Simd {
+
+namespace {
+
+/// The kernels either read vertices from one array, or through an array of pointers.
+[[nodiscard]] const Vertex &vertexAt(const Vertex *vertices, qsizetype i) { return vertices[i]; }
+[[nodiscard]] const Vertex &vertexAt(const Vertex *const *vertices, qsizetype i) { return *vertices[i]; }
+
+[[nodiscard]] VertexType classify(const Plane &plane, const Vertex &vertex, float epsilon)
+{
+    const auto t = dotProduct(plane.normal(), vertex.position()) - plane.w();
+    return (t < -epsilon) ? Back : (t > epsilon) ? Front : Coplanar;
+}
+
+template<typename Vertices>
+VertexType classifyScalar(const Plane &plane, Vertices vertices, qsizetype count,
+                          float epsilon, VertexType *types)
+{
+    auto polygonType = Coplanar;
+
+    for (auto i = qsizetype{0}; i < count; ++i) {
+        types[i] = classify(plane, vertexAt(vertices, i), epsilon);
+        polygonType = static_cast<VertexType>(polygonType | types[i]);
+    }
+
+    return polygonType;
+}
+
+void transformScalar(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                     const Vertex *vertices, qsizetype count, Vertex *transformed)
+{
+    for (auto i = qsizetype{0}; i < count; ++i)
+        transformed[i] = Vertex{matrix * vertices[i].position(), rotation * vertices[i].normal()};
+}
+
+#ifdef QTCSG_SIMD_X86
+
+// The kernels read positions straight from the vertex array. This requires the
+// position to be the first member of `Vertex`, and to consist of three floats.
+// Loading a position also reads the float following it, which must still be
+// part of the vertex.
+static_assert(std::is_standard_layout_v<Vertex>);
+static_assert(sizeof(QVector3D) == 3 * sizeof(float));
+static_assert(sizeof(Vertex) >= 4 * sizeof(float));
+
+[[nodiscard]] const float *position(const Vertex *vertex)
+{
+    return reinterpret_cast<const float *>(vertex);
+}
+
+/// Spreads the bits of an eight bit mask into the bytes of a word,
+/// so that the types of eight vertices can be built at once.
+constexpr auto spreadBits = [] {
+    auto table = std::array<quint64, 256>{};
+
+    for (auto mask = 0; mask < 256; ++mask) {
+        for (auto k = 0; k < 8; ++k)
+            table[mask] |= static_cast<quint64>((mask >> k) & 1) << (8 * k);
+    }
+
+    return table;
+}();
+
+/// Merges the comparison masks of up to eight vertices into their types.
+/// As x86 is little-endian, the first byte of the word is the type of the first vertex.
+int storeTypes(int frontMask, int backMask, qsizetype count, VertexType *types)
+{
+    const auto packed = spreadBits[frontMask] | (spreadBits[backMask] << 1);
+    std::memcpy(types, &packed, static_cast<std::size_t>(count));
+
+    return (frontMask ? Front : Coplanar) | (backMask ? Back : Coplanar);
+}
+
+/// Classifies four vertices at once. The last vertex gets repeated to fill
+/// the lanes of incomplete blocks, but its types are not stored again.
+template<typename Vertices>
+__attribute__((target("sse2")))
+VertexType classifySse2(const Plane &plane, Vertices vertices, qsizetype count,
+                        float epsilon, VertexType *types)
+{
+    const auto nx = _mm_set1_ps(plane.normal().x());
+    const auto ny = _mm_set1_ps(plane.normal().y());
+    const auto nz = _mm_set1_ps(plane.normal().z());
+    const auto w = _mm_set1_ps(plane.w());
+    const auto front = _mm_set1_ps(epsilon);
+    const auto back = _mm_set1_ps(-epsilon);
+
+    auto polygonType = 0;
+
+    for (auto i = qsizetype{0}; i < count; i += 4) {
+        const auto last = count - 1;
+
+        // Each load also reads the first float following the position,
+        // which still is part of the vertex. Transposing gives x, y, and z.
+        auto x = _mm_loadu_ps(position(&vertexAt(vertices, i)));
+        auto y = _mm_loadu_ps(position(&vertexAt(vertices, std::min(i + 1, last))));
+        auto z = _mm_loadu_ps(position(&vertexAt(vertices, std::min(i + 2, last))));
+        auto unused = _mm_loadu_ps(position(&vertexAt(vertices, std::min(i + 3, last))));
+        _MM_TRANSPOSE4_PS(x, y, z, unused);
+
+        // Same order of operations as `dotProduct()`, so that results match exactly.
+        const auto t = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, x), _mm_mul_ps(ny, y)),
+                                             _mm_mul_ps(nz, z)), w);
+
+        polygonType |= storeTypes(_mm_movemask_ps(_mm_cmpgt_ps(t, front)),
+                                  _mm_movemask_ps(_mm_cmplt_ps(t, back)),
+                                  std::min<qsizetype>(4, count - i), types + i);
+    }
+
+    return static_cast<VertexType>(polygonType);
+}
+
+/// Multiplies the columns of a matrix with the components of a vector, broadcasted
+/// from the lanes `x`, `y` and `z` of `vector`. The operations have the same order
+/// as in `QMatrix4x4::operator*()`, so that results match exactly.
+template<int x, int y, int z>
+__attribute__((target("sse2")))
+__m128 multiply(const __m128 columns[4], __m128 vector)
+{
+    const auto product = _mm_add_ps(_mm_mul_ps(columns[0], _mm_shuffle_ps(vector, vector, _MM_SHUFFLE(x, x, x, x))),
+                                    _mm_mul_ps(columns[1], _mm_shuffle_ps(vector, vector, _MM_SHUFFLE(y, y, y, y))));
+    return _mm_add_ps(_mm_add_ps(product, _mm_mul_ps(columns[2], _mm_shuffle_ps(vector, vector, _MM_SHUFFLE(z, z, z, z)))),
+                      columns[3]);
+}
+
+/// Transforms position and normal of each vertex with one matrix-vector product each.
+/// Matrices with perspective division are left to the scalar kernel.
+__attribute__((target("sse2")))
+void transformSse2(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                   const Vertex *vertices, qsizetype count, Vertex *transformed)
+{
+    if (!isAffine(matrix))
+        return transformScalar(matrix, rotation, vertices, count, transformed);
+
+    const __m128 positionColumns[4] = {
+        _mm_loadu_ps(matrix.constData() + 0), _mm_loadu_ps(matrix.constData() + 4),
+        _mm_loadu_ps(matrix.constData() + 8), _mm_loadu_ps(matrix.constData() + 12),
+    };
+
+    const __m128 normalColumns[4] = {
+        _mm_loadu_ps(rotation.constData() + 0), _mm_loadu_ps(rotation.constData() + 4),
+        _mm_loadu_ps(rotation.constData() + 8), _mm_loadu_ps(rotation.constData() + 12),
+    };
+
+    for (auto i = qsizetype{0}; i < count; ++i) {
+        // Both loads stay within the vertex: The first one reads the position and
+        // the normal's x, the second one reads the position's z and the normal.
+        const auto first = _mm_loadu_ps(position(&vertices[i]));
+        const auto second = _mm_loadu_ps(position(&vertices[i]) + 2);
+
+        alignas(16) float p[4];
+        alignas(16) float n[4];
+
+        _mm_store_ps(p, multiply<0, 1, 2>(positionColumns, first));
+        _mm_store_ps(n, multiply<1, 2, 3>(normalColumns, second));
+
+        transformed[i] = Vertex{{p[0], p[1], p[2]}, {n[0], n[1], n[2]}};
+    }
+}
+
+/// Classifies eight vertices at once, with the same transposition as the SSE2 kernel,
+/// but applied to both halves of the registers. Just like there, the last vertex gets
+/// repeated to fill incomplete blocks, so that triangles and quads also take this path.
+template<typename Vertices>
+__attribute__((target("avx2")))
+VertexType classifyAvx2(const Plane &plane, Vertices vertices, qsizetype count,
+                        float epsilon, VertexType *types)
+{
+    const auto nx = _mm256_set1_ps(plane.normal().x());
+    const auto ny = _mm256_set1_ps(plane.normal().y());
+    const auto nz = _mm256_set1_ps(plane.normal().z());
+    const auto w = _mm256_set1_ps(plane.w());
+    const auto front = _mm256_set1_ps(epsilon);
+    const auto back = _mm256_set1_ps(-epsilon);
+
+    auto polygonType = 0;
+
+    for (auto i = qsizetype{0}; i < count; i += 8) {
+        const auto last = count - 1;
+
+        // Vertex i + k goes into the lower half of row k, vertex i + k + 4 into its upper half.
+        __m256 rows[4];
+
+        for (auto k = 0; k < 4; ++k) {
+            const auto lower = _mm_loadu_ps(position(&vertexAt(vertices, std::min(i + k, last))));
+            const auto upper = _mm_loadu_ps(position(&vertexAt(vertices, std::min(i + k + 4, last))));
+            rows[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(lower), upper, 1);
+        }
+
+        const auto xy01 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        const auto xy23 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        const auto zw01 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        const auto zw23 = _mm256_unpackhi_ps(rows[2], rows[3]);
+
+        const auto x = _mm256_shuffle_ps(xy01, xy23, _MM_SHUFFLE(1, 0, 1, 0));
+        const auto y = _mm256_shuffle_ps(xy01, xy23, _MM_SHUFFLE(3, 2, 3, 2));
+        const auto z = _mm256_shuffle_ps(zw01, zw23, _MM_SHUFFLE(1, 0, 1, 0));
+
+        // Same order of operations as `dotProduct()`, so that results match exactly.
+        const auto t = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, x),
+                                                                 _mm256_mul_ps(ny, y)),
+                                                   _mm256_mul_ps(nz, z)), w);
+
+        polygonType |= storeTypes(_mm256_movemask_ps(_mm256_cmp_ps(t, front, _CMP_GT_OQ)),
+                                  _mm256_movemask_ps(_mm256_cmp_ps(t, back, _CMP_LT_OQ)),
+                                  std::min<qsizetype>(8, count - i), types + i);
+    }
+
+    // Compilers don't always clear the upper halves on their own, for instance when not
+    // optimizing. Legacy SSE code of the caller would pay for a state transition then.
+    _mm256_zeroupper();
+
+    return static_cast<VertexType>(polygonType);
+}
+
+#endif // QTCSG_SIMD_X86
+
+template<typename Vertices>
+using Kernel = VertexType (*)(const Plane &, Vertices, qsizetype, float, VertexType *);
+using TransformKernel = void (*)(const QMatrix4x4 &, const QMatrix4x4 &, const Vertex *, qsizetype, Vertex *);
+
+template<typename Vertices>
+Kernel<Vertices> kernel(InstructionSet instructionSet)
+{
+    switch (instructionSet) {
+    case InstructionSet::Scalar:
+        return &classifyScalar<Vertices>;
+
+    case InstructionSet::SSE2:
+#ifdef QTCSG_SIMD_X86
+        return &classifySse2<Vertices>;
+#else
+        break;
+#endif
+
+    case InstructionSet::AVX2:
+#ifdef QTCSG_SIMD_X86
+        return &classifyAvx2<Vertices>;
+#else
+        break;
+#endif
+    }
+
+    return &classifyScalar<Vertices>;
+}
+
+/// Classifies with the kernel for the best instruction set. Single polygons
+/// rarely fill the lanes of its registers though, and are left to the scalar
+/// kernel, which has less overhead for them.
+template<typename Vertices>
+VertexType classifyWithBestKernel(const Plane &plane, Vertices vertices, qsizetype count,
+                                  float epsilon, VertexType *types)
+{
+    constexpr auto minimumCount = 8;
+    static const auto bestKernel = kernel<Vertices>(bestInstructionSet());
+
+    if (count < minimumCount)
+        return classifyScalar(plane, vertices, count, epsilon, types);
+
+    return bestKernel(plane, vertices, count, epsilon, types);
+}
+
+/// Positions and normals already fill the four lanes of SSE2 registers,
+/// therefore AVX2 has no dedicated transform kernel.
+TransformKernel transformKernel(InstructionSet instructionSet)
+{
+    switch (instructionSet) {
+    case InstructionSet::Scalar:
+        return &transformScalar;
+
+    case InstructionSet::SSE2:
+    case InstructionSet::AVX2:
+#ifdef QTCSG_SIMD_X86
+        return &transformSse2;
+#else
+        break;
+#endif
+    }
+
+    return &transformScalar;
+}
+
+} // namespace
+
+bool isSupported(InstructionSet instructionSet)
+{
+    switch (instructionSet) {
+    case InstructionSet::Scalar:
+        return true;
+
+    case InstructionSet::SSE2:
+#ifdef QTCSG_SIMD_X86
+        return __builtin_cpu_supports("sse2");
+#else
+        return false;
+#endif
+
+    case InstructionSet::AVX2:
+#ifdef QTCSG_SIMD_X86
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    return false;
+}
+
+InstructionSet bestInstructionSet()
+{
+    static const auto best = [] {
+        for (const auto instructionSet: {InstructionSet::AVX2, InstructionSet::SSE2}) {
+            if (isSupported(instructionSet))
+                return instructionSet;
+        }
+
+        return InstructionSet::Scalar;
+    }();
+
+    return best;
+}
+
+VertexType classifyVertices(const Plane &plane, const Vertex *vertices, qsizetype count,
+                            float epsilon, VertexType *types)
+{
+    return classifyWithBestKernel(plane, vertices, count, epsilon, types);
+}
+
+VertexType classifyVertices(InstructionSet instructionSet,
+                            const Plane &plane, const Vertex *vertices, qsizetype count,
+                            float epsilon, VertexType *types)
+{
+    Q_ASSERT(isSupported(instructionSet));
+    return kernel<const Vertex *>(instructionSet)(plane, vertices, count, epsilon, types);
+}
+
+VertexType classifyVertices(const Plane &plane, const Vertex *const *vertices, qsizetype count,
+                            float epsilon, VertexType *types)
+{
+    return classifyWithBestKernel(plane, vertices, count, epsilon, types);
+}
+
+VertexType classifyVertices(InstructionSet instructionSet,
+                            const Plane &plane, const Vertex *const *vertices, qsizetype count,
+                            float epsilon, VertexType *types)
+{
+    Q_ASSERT(isSupported(instructionSet));
+    return kernel<const Vertex *const *>(instructionSet)(plane, vertices, count, epsilon, types);
+}
+
+void transformVertices(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                       const Vertex *vertices, qsizetype count, Vertex *transformed)
+{
+    static const auto bestKernel = transformKernel(bestInstructionSet());
+    bestKernel(matrix, rotation, vertices, count, transformed);
+}
+
+void transformVertices(InstructionSet instructionSet,
+                       const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                       const Vertex *vertices, qsizetype count, Vertex *transformed)
+{
+    Q_ASSERT(isSupported(instructionSet));
+    transformKernel(instructionSet)(matrix, rotation, vertices, count, transformed);
+}
+
+} // namespace QtCSG::Simd
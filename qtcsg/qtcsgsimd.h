@@ -0,0 +1,88 @@
+/* QtCSG provides Constructive Solid Geometry (CSG) for Qt
+ * Copyright Ⓒ 2023 Mathias Hasselmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+#ifndef QTCSG_QTCSGSIMD_H
+#define QTCSG_QTCSGSIMD_H
+
+#include "qtcsg.h"
+
+namespace QtCSG::Simd {
+
+/// Position of a vertex relative to a plane. Polygons get the union of the
+/// types of their vertices, therefore polygons crossing the plane are `Spanning`.
+enum VertexType : quint8 {
+    Coplanar = 0,
+    Front = (1 << 0),
+    Back = (1 << 1),
+    Spanning = Front | Back
+};
+
+/// The instruction sets for which the functions of this namespace have kernels.
+enum class InstructionSet {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+/// Tells if the current CPU supports `instructionSet`.
+[[nodiscard]] bool isSupported(InstructionSet instructionSet);
+
+/// Returns the best instruction set supported by the current CPU.
+[[nodiscard]] InstructionSet bestInstructionSet();
+
+/// Classifies the positions of `count` `vertices` relative to `plane`, and
+/// stores the type of each vertex in `types`. Returns the union of all types.
+/// The kernel for the best instruction set of the current CPU is used,
+/// unless there are too few vertices to fill its registers.
+VertexType classifyVertices(const Plane &plane, const Vertex *vertices, qsizetype count,
+                            float epsilon, VertexType *types);
+
+/// Like `classifyVertices()`, but uses the kernel for `instructionSet`,
+/// which must be supported by the current CPU.
+VertexType classifyVertices(InstructionSet instructionSet,
+                            const Plane &plane, const Vertex *vertices, qsizetype count,
+                            float epsilon, VertexType *types);
+
+/// Like `classifyVertices()`, but reads the vertices through `count` pointers. This
+/// allows the vertices of many polygons to be classified at once without copying them,
+/// so that the wider kernels get used even for triangles and quads.
+VertexType classifyVertices(const Plane &plane, const Vertex *const *vertices, qsizetype count,
+                            float epsilon, VertexType *types);
+
+/// Like the previous `classifyVertices()`, but uses the kernel for `instructionSet`,
+/// which must be supported by the current CPU.
+VertexType classifyVertices(InstructionSet instructionSet,
+                            const Plane &plane, const Vertex *const *vertices, qsizetype count,
+                            float epsilon, VertexType *types);
+
+/// Transforms `count` `vertices` by `matrix`, and stores them in `transformed`,
+/// which may be the very same array as `vertices`. The normals are transformed
+/// by `rotation`, which must be `findRotation(matrix)`. This gives the same
+/// results as `Vertex::transformed()`, but derives the rotation only once.
+void transformVertices(const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                       const Vertex *vertices, qsizetype count, Vertex *transformed);
+
+/// Like `transformVertices()`, but uses the kernel for `instructionSet`,
+/// which must be supported by the current CPU.
+void transformVertices(InstructionSet instructionSet,
+                       const QMatrix4x4 &matrix, const QMatrix4x4 &rotation,
+                       const Vertex *vertices, qsizetype count, Vertex *transformed);
+
+} // namespace QtCSG::Simd
+
+#endif // QTCSG_QTCSGSIMD_H
@@ -19,6 +19,7 @@
 #include "qtcsgutils.h"
 
 #include <QLoggingCategory>
+#include <QThreadPool>
 
 namespace QtCSG::Utils {
 
@@ -58,4 +59,47 @@ void enabledColorfulLogging()
                        QTCSG_MESSAGELOGCONTEXT_PATTERN);
 }
 
+bool TaskGroup::tryRun(const std::function<void()> &task)
+{
+    // Count the task before starting it, so that wait() cannot miss it.
+    // If the pool has no idle thread, the count is rolled back again.
+    {
+        const auto locker = QMutexLocker{&m_mutex};
+        ++m_pending;
+    }
+
+    const auto started = QThreadPool::globalInstance()->tryStart([this, task] {
+        task();
+        finish();
+    });
+
+    if (!started)
+        finish();
+
+    return started;
+}
+
+void TaskGroup::run(const std::function<void()> &task)
+{
+    if (!tryRun(task))
+        task();
+}
+
+void TaskGroup::wait()
+{
+    // Running tasks might start new tasks, therefore wait until none are pending.
+    const auto locker = QMutexLocker{&m_mutex};
+
+    while (m_pending > 0)
+        m_finished.wait(&m_mutex);
+}
+
+void TaskGroup::finish()
+{
+    const auto locker = QMutexLocker{&m_mutex};
+
+    if (--m_pending == 0)
+        m_finished.wakeAll();
+}
+
 } // namespace QtCSG::Utils
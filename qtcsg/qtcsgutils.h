@@ -22,6 +22,10 @@
 #include "qtcsg.h"
 
 #include <QMetaEnum>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <functional>
 
 #ifdef  __cpp_lib_source_location
 #include <source_location>
@@ -53,6 +57,61 @@ template<typename T, typename = std::enable_if_t<std::is_enum_v<T>>>
 /// Enable colorful logging, so that information is easier to understand.
 void enabledColorfulLogging();
 
+/// Hashes vertex positions, so that they can be used as keys of unordered containers.
+struct PositionHash
+{
+    [[nodiscard]] std::size_t operator()(QVector3D position) const noexcept
+    {
+        auto seed = std::size_t{0};
+
+        for (const auto value: {position.x(), position.y(), position.z()})
+            seed ^= std::hash<float>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+
+        return seed;
+    }
+};
+
+/// Hashes vertices, so that they can be used as keys of unordered containers.
+struct VertexHash
+{
+    [[nodiscard]] std::size_t operator()(const Vertex &vertex) const noexcept
+    {
+        const auto hash = PositionHash{};
+        return hash(vertex.position()) ^ (hash(vertex.normal()) << 1);
+    }
+};
+
+/// A group of tasks that run concurrently on the global `QThreadPool`.
+/// Tasks may start further tasks of the same group. Tasks are only started
+/// when the pool has an idle thread, so waiting tasks cannot starve the pool.
+class TaskGroup
+{
+public:
+    TaskGroup() = default;
+    ~TaskGroup() { wait(); }
+
+    Q_DISABLE_COPY_MOVE(TaskGroup)
+
+    /// Start `task` on an idle thread of the pool. Returns `false` without
+    /// running `task` if there is no idle thread.
+    [[nodiscard]] bool tryRun(const std::function<void()> &task);
+
+    /// Run `task` on an idle thread of the pool, or on the calling thread if
+    /// there is no idle thread.
+    void run(const std::function<void()> &task);
+
+    /// Wait until all tasks of this group have finished, including the tasks
+    /// started by these tasks.
+    void wait();
+
+private:
+    void finish();
+
+    QMutex m_mutex;
+    QWaitCondition m_finished;
+    int m_pending = 0;
+};
+
 } // namespace QtCSG::Utils
 
 #endif // QTCSG_QTCSGUTILS_H
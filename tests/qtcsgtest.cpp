@@ -19,12 +19,67 @@
 #include "qtcsgtest.h"
 
 #include <qtcsg/qtcsg.h>
+#include <qtcsg/qtcsgexpression.h>
 #include <qtcsg/qtcsgmath.h>
+#include <qtcsg/qtcsgsimd.h>
+#include <qtcsg/qtcsgutils.h>
+
+#include <QAtomicInt>
+#include <QScopeGuard>
+#include <QThreadPool>
+
+Q_DECLARE_METATYPE(QtCSG::Simd::InstructionSet)
 
 namespace QtCSG::Tests {
 
 using std::make_pair;
 
+namespace {
+
+float volume(const Geometry &geometry)
+{
+    auto sum = 0.0f;
+
+    for (const auto &polygon: geometry.polygons()) {
+        const auto vertices = polygon.vertices();
+
+        for (auto i = 2; i < vertices.count(); ++i) {
+            sum += dotProduct(vertices[0].position(),
+                              crossProduct(vertices[i - 1].position(),
+                                           vertices[i].position()));
+        }
+    }
+
+    return sum / 6;
+}
+
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    int allocations = 0;
+    int deallocations = 0;
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        ++deallocations;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+} // namespace
+
 class Test : public QObject
 {
     Q_OBJECT
@@ -117,6 +172,643 @@ private slots:
         QCOMPARE(c.polygons().count(), expectedPolygonCount);
     }
 
+    void testSplitStrategy_data()
+    {
+        QTest::addColumn<SplitStrategy>("strategy");
+
+        QTest::newRow("FirstPolygon") << SplitStrategy::FirstPolygon;
+        QTest::newRow("SampledCost")  << SplitStrategy::SampledCost;
+    }
+
+    void testSplitStrategy()
+    {
+        const QFETCH(SplitStrategy, strategy);
+        const auto options = Options{.splitStrategy = strategy};
+
+        const auto a = cube({-0.25f, -0.25f, -0.25f});
+        const auto b = cube({+0.25f, +0.25f, +0.25f});
+
+        QCOMPARE(volume(a), 8);
+        QCOMPARE(volume(merge(a, b, options)), 12.625f);
+        QCOMPARE(volume(subtract(a, b, options)), 4.625f);
+        QCOMPARE(volume(intersect(a, b, options)), 3.375f);
+
+        const auto s = sphere({}, 1, 32, 16);
+        const auto maybeNode = Node::fromPolygons(s.polygons(), options);
+
+        QVERIFY(std::holds_alternative<Node>(maybeNode));
+        QCOMPARE(std::get<Node>(maybeNode).allPolygons().count(), s.polygons().count());
+    }
+
+    void testParallelOperations()
+    {
+        const auto a = sphere({}, 1, 64, 32);
+        const auto b = cylinder({}, 3, 0.5f, 64);
+
+        const auto serialNode = Node::fromPolygons(a.polygons());
+        const auto parallelNode = Node::fromPolygons(a.polygons(), Options{.parallel = true});
+
+        QVERIFY(std::holds_alternative<Node>(serialNode));
+        QVERIFY(std::holds_alternative<Node>(parallelNode));
+        QCOMPARE(std::get<Node>(parallelNode).allPolygons(), std::get<Node>(serialNode).allPolygons());
+
+        const auto tree = FlatTree{std::get<Node>(serialNode)};
+        const auto polygons = b.polygons() + cylinder({}, 3, 0.4f, 1024).polygons();
+        QCOMPARE(tree.clipPolygons(polygons, Options{.parallel = true}), tree.clipPolygons(polygons));
+
+        auto serialClip = std::get<Node>(Node::fromPolygons(polygons));
+        auto parallelClip = std::get<Node>(Node::fromPolygons(polygons));
+        serialClip.clipTo(tree);
+        parallelClip.clipTo(tree, Options{.parallel = true});
+        QCOMPARE(parallelClip.allPolygons(), serialClip.allPolygons());
+
+        QCOMPARE(merge(a, b, Options{.parallel = true}).polygons(), merge(a, b).polygons());
+        QCOMPARE(subtract(a, b, Options{.parallel = true}).polygons(), subtract(a, b).polygons());
+        QCOMPARE(intersect(a, b, Options{.parallel = true}).polygons(), intersect(a, b).polygons());
+    }
+
+    void testTaskGroup()
+    {
+        // Tasks start further tasks while wait() is already running, and some of these
+        // starts fail because the pool is busy. None of this must let wait() miss a task.
+        static constexpr auto depth = 6;
+        static constexpr auto expectedCount = (1 << (depth + 1)) - 1;
+
+        // Oversubscribe the pool, so that task starts and wait() interleave more often.
+        const auto pool = QThreadPool::globalInstance();
+        const auto maxThreadCount = pool->maxThreadCount();
+        const auto restoreThreadCount = qScopeGuard([pool, maxThreadCount] {
+            pool->setMaxThreadCount(maxThreadCount);
+        });
+
+        pool->setMaxThreadCount(std::max(8, 2 * maxThreadCount));
+
+        for (auto round = 0; round < 2000; ++round) {
+            auto tasks = Utils::TaskGroup{};
+            auto count = QAtomicInt{};
+
+            auto spawn = std::function<void(int)>{};
+            spawn = [&tasks, &count, &spawn](int level) {
+                count.ref();
+
+                if (level == depth)
+                    return;
+
+                for (auto i = 0; i < 2; ++i) {
+                    if (!tasks.tryRun([&spawn, level] { spawn(level + 1); }))
+                        spawn(level + 1);
+                }
+            };
+
+            tasks.run([&spawn] { spawn(0); });
+            tasks.wait();
+
+            QCOMPARE(count.loadAcquire(), expectedCount);
+        }
+    }
+
+    void testNaryOperations()
+    {
+        const auto row = QList<Geometry>{
+            cube({0.0f, 0, 0}),
+            cube({1.5f, 0, 0}),
+            cube({3.0f, 0, 0}),
+            cube({4.5f, 0, 0}),
+            cube({6.0f, 0, 0}),
+        };
+
+        const auto overlapping = QList<Geometry>{
+            cube({0.0f, 0, 0}),
+            cube({0.5f, 0, 0}),
+            cube({1.0f, 0, 0}),
+        };
+
+        QCOMPARE(volume(unite(row)), 5 * 8 - 4 * 2.0f);
+        QCOMPARE(volume(difference(cube({3, 0, 0}, 5), row)), 1000 - (5 * 8 - 4 * 2.0f));
+        QCOMPARE(volume(intersection(overlapping)), 4);
+
+        QCOMPARE(unite({}).polygons().count(), 0);
+        QCOMPARE(intersection({}).polygons().count(), 0);
+        QCOMPARE(unite({row.first()}).polygons(), row.first().polygons());
+        QCOMPARE(difference(row.first(), QList<Geometry>{}).polygons(), row.first().polygons());
+
+        QTest::ignoreMessage(QtWarningMsg, "Invalid geometry, the reported error is FileFormatError");
+        QCOMPARE(unite({row.first(), Geometry{Error::FileFormatError}}).error(), Error::FileFormatError);
+    }
+
+    void testTreeCache()
+    {
+        const auto a = sphere({}, 1, 32, 16);
+        const auto b = cube({0.5f, 0.5f, 0.5f});
+        const auto copy = a;
+
+        const auto tree = a.tree();
+        QVERIFY(std::holds_alternative<std::shared_ptr<const Node>>(tree));
+
+        const auto cachedTree = std::get<std::shared_ptr<const Node>>(tree);
+        const auto cachedPolygons = cachedTree->allPolygons();
+
+        QCOMPARE(std::get<std::shared_ptr<const Node>>(a.tree()), cachedTree);
+        QCOMPARE(std::get<std::shared_ptr<const Node>>(copy.tree()), cachedTree);
+        QCOMPARE(std::get<std::shared_ptr<const Node>>(a.tree(Options{.parallel = true})), cachedTree);
+
+        const auto united = merge(a, b);
+        const auto subtracted = subtract(a, b);
+
+        QCOMPARE(merge(a, b).polygons(), united.polygons());
+        QCOMPARE(subtract(a, b).polygons(), subtracted.polygons());
+        QCOMPARE(subtract(Geometry{a.polygons()}, b).polygons(), subtracted.polygons());
+        QCOMPARE(cachedTree->allPolygons(), cachedPolygons);
+
+        const auto sampledTree = a.tree(Options{.splitStrategy = SplitStrategy::SampledCost});
+        QVERIFY(std::holds_alternative<std::shared_ptr<const Node>>(sampledTree));
+        QVERIFY(std::get<std::shared_ptr<const Node>>(sampledTree) != cachedTree);
+    }
+
+    void testBoundingBox()
+    {
+        const auto box = cube({1, 2, 3}, {1, 2, 3}).boundingBox();
+
+        QVERIFY(!box.isNull());
+        QCOMPARE(box.minimum(), QVector3D(0, 0, 0));
+        QCOMPARE(box.maximum(), QVector3D(2, 4, 6));
+
+        QVERIFY(Geometry{}.boundingBox().isNull());
+        QVERIFY(!Geometry{}.boundingBox().intersects(box));
+        QVERIFY(!box.intersects(BoundingBox{}));
+
+        QVERIFY(box.intersects(box));
+        QVERIFY(box.intersects({{1, 1, 1}, {3, 3, 3}}));
+        QVERIFY(box.intersects({{2, 4, 6}, {3, 5, 7}}));   // touching corners
+        QVERIFY(!box.intersects({{2.1f, 0, 0}, {3, 5, 7}}));
+        QVERIFY(!box.intersects({{0, 0, -2}, {2, 4, -0.1f}}));
+
+        const auto a = cube({-1.5f, 0, 0});
+        const auto b = cube({+1.5f, 0, 0});
+
+        QCOMPARE(merge(a, b).polygons(), a.polygons() + b.polygons());
+        QCOMPARE(subtract(a, b).polygons(), a.polygons());
+        QCOMPARE(intersect(a, b).polygons().count(), 0);
+
+        // Disjoint results keep the attributes of both operands, like all other results.
+        auto c = b;
+        c.setAttribute(0, "payload");
+        QCOMPARE(subtract(a, c).attribute(0), QVariant{"payload"});
+        QCOMPARE(intersect(a, c).attribute(0), QVariant{"payload"});
+
+        // Inversed solids are unbounded, and enclose everything outside of their polygons.
+        const auto inverse = b.inversed();
+
+        QVERIFY(b.isBounded());
+        QVERIFY(!inverse.isBounded());
+        QVERIFY(!inverse.transformed(translation({1, 2, 3})).isBounded());
+        QVERIFY(Geometry{}.isBounded());
+
+        for (const auto &options: {Options{}, Options{.overlapCulling = true}}) {
+            QCOMPARE(volume(merge(a, inverse, options)), volume(inverse));
+            QCOMPARE(subtract(a, inverse, options).polygons().count(), 0);
+            QCOMPARE(volume(intersect(a, inverse, options)), volume(a));
+            QCOMPARE(volume(intersect(inverse, a, options)), volume(a));
+        }
+    }
+
+    void testOverlapCulling_data()
+    {
+        QTest::addColumn<Geometry>("a");
+        QTest::addColumn<Geometry>("b");
+
+        QTest::newRow("cube:corner") << cube({}, 4) << cube({4, 4, 4});
+        QTest::newRow("cube:inside") << cube({}, 4) << cube({1, 1, 1});
+        QTest::newRow("cube:overlapping") << cube() << cube({0.5f, 0.5f, 0.5f});
+        QTest::newRow("sphere:hole") << sphere({}, 4, 32, 16) << cylinder({0, 4, 0}, {0, 2, 0}, 0.5f);
+    }
+
+    void testOverlapCulling()
+    {
+        const QFETCH(Geometry, a);
+        const QFETCH(Geometry, b);
+
+        const auto options = Options{.overlapCulling = true};
+
+        QCOMPARE(volume(merge(a, b, options)), volume(merge(a, b)));
+        QCOMPARE(volume(subtract(a, b, options)), volume(subtract(a, b)));
+        QCOMPARE(volume(intersect(a, b, options)), volume(intersect(a, b)));
+
+        QCOMPARE(volume(subtract(b, a, options)), volume(subtract(b, a)));
+        QCOMPARE(volume(intersect(b, a, options)), volume(intersect(b, a)));
+    }
+
+    void testPendingTransform()
+    {
+        const auto part = sphere();
+        const auto placed = part.transformed(rotation(30, {0, 0, 1})).transformed(translation({5, 0, 0}));
+
+        QVERIFY(!part.isTransformPending());
+        QVERIFY(placed.isTransformPending());
+
+        // The transforms are composed, instead of being applied one after another.
+        const auto composed = part.transformed(translation({5, 0, 0}) * rotation(30, {0, 0, 1}));
+        QCOMPARE(placed.polygons(), composed.polygons());
+        QCOMPARE(placed.boundingBox().minimum(), composed.boundingBox().minimum());
+        QCOMPARE(placed.polygons().size(), part.polygons().size());
+
+        // The transform is applied once, and shared by all copies.
+        const auto copy = placed;
+        QCOMPARE(&copy.polygons(), &placed.polygons());
+
+        auto taken = placed;
+        QCOMPARE(taken.takePolygons(), composed.polygons());
+        QVERIFY(!taken.isTransformPending());
+        QVERIFY(taken.isEmpty());
+        QCOMPARE(placed.polygons(), composed.polygons());
+
+        QCOMPARE(volume(subtract(cube({}, 8), placed)), volume(subtract(cube({}, 8), composed)));
+    }
+
+    void testTransformedTree()
+    {
+        QVERIFY(isSimilarity(translation({1, 2, 3}) * rotation(40, {1, 0, 1}) * scale({2, 2, 2})));
+        QVERIFY(isSimilarity(scale({-1, 1, 1})));
+        QVERIFY(!isSimilarity(scale({1, 2, 1})));
+
+        const auto part = cylinder({}, 2, 0.5f);
+        const auto tool = cube({0.5f, 0.5f, 0.5f}, 1.5f);
+
+        const auto placements = {
+            translation({0.5f, 0, 0}) * rotation(30, {0, 1, 0}),
+            translation({0, 0.2f, 0}) * rotation(-60, {1, 0, 0}) * scale({1.5f, 1.5f, 1.5f}),
+            scale({-1, 1, 1}) * rotation(45, {0, 0, 1}),
+        };
+
+        for (const auto &matrix: placements) {
+            const auto instance = part.transformed(matrix);
+            const auto tree = std::get<std::shared_ptr<const Node>>(instance.tree());
+
+            // The instance reuses the tree of the part, without partitioning it again.
+            const auto partTree = std::get<std::shared_ptr<const Node>>(part.tree(Options{
+                .tolerance = tree->tolerance() / findScale(matrix).x(),
+            }));
+
+            QCOMPARE(tree->allPolygons(), partTree->transformed(matrix).allPolygons());
+            QCOMPARE(tree->allPolygons().size(), partTree->allPolygons().size());
+            QVERIFY(qFuzzyCompare(tree->tolerance(), defaultTolerance()));
+
+            // The transformed tree must be a valid tree for the transformed polygons.
+            const auto rebuilt = Geometry{instance.polygons()};
+
+            QVERIFY(qFuzzyCompare(volume(subtract(tool, instance)), volume(subtract(tool, rebuilt))));
+            QVERIFY(qFuzzyCompare(volume(intersect(tool, instance)), volume(intersect(tool, rebuilt))));
+        }
+    }
+
+    void testPrimitiveCache()
+    {
+        QCOMPARE(primitiveCacheLimit(), defaultPrimitiveCacheLimit());
+
+        const auto tree = [](const Geometry &geometry) {
+            return std::get<std::shared_ptr<const Node>>(geometry.tree());
+        };
+
+        // Primitives with the same parameters share their polygons, and their trees.
+        const auto a = sphere({1, 2, 3}, 2, 12, 6);
+        const auto b = sphere({1, 2, 3}, 2, 12, 6);
+        const auto c = sphere({1, 2, 3}, 2, 12, 7);
+
+        QCOMPARE(tree(a), tree(b));
+        QVERIFY(tree(a) != tree(c));
+
+        QCOMPARE(tree(cylinder({}, 3, 0.5f)), tree(cylinder({}, 3, 0.5f)));
+        QCOMPARE(tree(cube({}, 2)), tree(parseGeometry("cube(r=2)")));
+        QCOMPARE(tree(cube({-0.0f, 0, 0}, 2)), tree(cube({0, 0, 0}, 2)));
+
+        // The trees count against the limit of the cache, like the polygons.
+        setPrimitiveCacheLimit(static_cast<int>(a.polygons().size()));
+        QVERIFY(tree(sphere({4, 5, 6}, 2, 12, 6)) != tree(sphere({4, 5, 6}, 2, 12, 6)));
+
+        setPrimitiveCacheLimit(0);
+
+        const auto uncached = sphere({1, 2, 3}, 2, 12, 6);
+        QVERIFY(tree(uncached) != tree(a));
+        QCOMPARE(uncached.polygons(), a.polygons());
+
+        setPrimitiveCacheLimit(defaultPrimitiveCacheLimit());
+    }
+
+    void testTakePolygons()
+    {
+        auto geometry = cube();
+        const auto copy = geometry;
+
+        QCOMPARE(&geometry.polygons(), &geometry.polygons());
+        QCOMPARE(geometry.boundingBox().maximum(), QVector3D(1, 1, 1));
+
+        const auto polygons = geometry.takePolygons();
+
+        QCOMPARE(polygons.size(), 6);
+        QVERIFY(geometry.isEmpty());
+        QVERIFY(geometry.boundingBox().isNull());
+
+        // Copies keep their polygons, and their cache.
+        QCOMPARE(copy.polygons(), polygons);
+        QCOMPARE(copy.boundingBox().maximum(), QVector3D(1, 1, 1));
+
+        auto polygon = polygons.constFirst();
+        const auto vertices = std::move(polygon).vertices();
+        QCOMPARE(vertices.size(), 4);
+        QCOMPARE(std::move(Geometry{polygons}).polygons(), polygons);
+    }
+
+    void testAttributes()
+    {
+        const auto withAttribute = [](const Geometry &geometry, int id, QString payload) {
+            auto polygons = geometry.polygons();
+
+            for (auto &polygon: polygons)
+                polygon = Polygon{polygon.vertices(), id};
+
+            auto result = Geometry{std::move(polygons)};
+            result.setAttribute(id, std::move(payload));
+            return result;
+        };
+
+        const auto a = withAttribute(cube({}, 2), 1, "red");
+        const auto b = withAttribute(sphere({1, 1, 1}, 1), 2, "blue");
+
+        for (const auto &options: {Options{}, Options{.overlapCulling = true}}) {
+            const auto result = subtract(a, b, options);
+
+            QCOMPARE(result.attribute(1).toString(), "red");
+            QCOMPARE(result.attribute(2).toString(), "blue");
+
+            auto ids = QList<int>{};
+
+            for (const auto &polygon: result.polygons()) {
+                if (!ids.contains(polygon.attribute()))
+                    ids.append(polygon.attribute());
+            }
+
+            std::sort(ids.begin(), ids.end());
+            QCOMPARE(ids, (QList<int>{1, 2}));
+        }
+
+        QCOMPARE(a.transformed(translation({1, 0, 0})).attribute(1).toString(), "red");
+        QCOMPARE(a.inversed().polygons().constFirst().attribute(), 1);
+        QCOMPARE(CompactGeometry{a}.toGeometry().attribute(1).toString(), "red");
+        QCOMPARE(IndexedGeometry{a}.toGeometry().attribute(1).toString(), "red");
+
+        // The deprecated shared values are mapped onto attributes.
+        QT_WARNING_PUSH
+        QT_WARNING_DISABLE_DEPRECATED
+
+        auto polygons = cube().polygons();
+
+        for (auto &polygon: polygons)
+            polygon = Polygon{polygon.vertices(), QVariant{"green"}};
+
+        const auto legacy = Geometry{polygons};
+        const auto id = legacy.polygons().constFirst().attribute();
+
+        QVERIFY(id < 0);
+        QCOMPARE(legacy.polygons().constLast().attribute(), id);
+        QCOMPARE(legacy.polygons().constFirst().shared().toString(), "green");
+        QCOMPARE(legacy.attribute(id).toString(), "green");
+        QCOMPARE(subtract(legacy, b).attribute(id).toString(), "green");
+        const auto unshared = Polygon{polygons.constFirst().vertices(), QVariant{}};
+        QCOMPARE(unshared.attribute(), 0);
+        QVERIFY(a.polygons().constFirst().shared().isNull());
+
+        QT_WARNING_POP
+    }
+
+    void testCompactGeometry()
+    {
+        auto polygons = sphere({1, 2, 3}, 2).polygons();
+
+        for (auto i = 0; i < polygons.size(); ++i)
+            polygons[i] = Polygon{polygons[i].vertices(), i / 10};
+
+        const auto geometry = Geometry{polygons};
+        const auto compact = CompactGeometry{geometry};
+
+        QCOMPARE(compact.size(), geometry.polygons().size());
+        QCOMPARE(compact.planes().size(), geometry.polygons().size());
+        QCOMPARE(compact.vertices(5).size(), static_cast<std::size_t>(polygons[5].size()));
+        QCOMPARE(compact.polygon(5), polygons[5]);
+        QCOMPARE(compact.toGeometry().polygons(), polygons);
+
+        QCOMPARE(compact.boundingBox().minimum(), geometry.boundingBox().minimum());
+        QCOMPARE(compact.boundingBox().maximum(), geometry.boundingBox().maximum());
+
+        const auto matrix = translation({1, 0, 0}) * rotation(90, {0, 0, 1});
+        const auto transformed = compact.transformed(matrix).toGeometry().polygons();
+        const auto expected = geometry.transformed(matrix).polygons();
+
+        QCOMPARE(transformed.size(), expected.size());
+
+        for (auto i = 0; i < transformed.size(); ++i) {
+            QCOMPARE(transformed[i].vertices(), expected[i].vertices());
+            QCOMPARE(transformed[i].plane(), expected[i].plane());
+            QCOMPARE(transformed[i].attribute(), polygons[i].attribute());
+        }
+
+        QCOMPARE(CompactGeometry{Geometry{Error::FileFormatError}}.error(), Error::FileFormatError);
+    }
+
+    void testIndexedGeometry()
+    {
+        const auto geometry = subtract(cube({}, 2), sphere({1, 1, 1}, 1));
+        const auto indexed = IndexedGeometry{geometry};
+
+        QCOMPARE(indexed.size(), geometry.polygons().size());
+        QCOMPARE(indexed.toGeometry().polygons(), geometry.polygons());
+        QVERIFY(indexed.vertices().size() < indexed.indices().size());
+
+        // The faces of a cube share positions, but not normals.
+        const auto indexedCube = IndexedGeometry{cube()};
+        QCOMPARE(indexedCube.vertices().size(), 24);
+        QCOMPARE(indexedCube.indices().size(), 24);
+        QCOMPARE(indexedCube.indices(1).size(), static_cast<std::size_t>(4));
+    }
+
+    void testSplitSharedEdge()
+    {
+        const auto plane = Plane::fromPoints({0.3f, 0, 0}, {0.3f, 1, 0}, {0.3f, 0, 1});
+        const auto normal = QVector3D{0, 0, 1};
+
+        // Two triangles sharing the edge from (0.1, 0.2, 0) to (0.9, 0.77, 0), which each
+        // of them walks in a different direction. Interpolating this edge in different
+        // directions gives different rounding errors.
+        const auto a = Polygon{{Vertex{{0.1f, 0.2f, 0}, normal}, Vertex{{0.9f, 0.77f, 0}, normal},
+                                Vertex{{0.1f, 1, 0}, normal}}};
+        const auto b = Polygon{{Vertex{{0.9f, 0.77f, 0}, normal}, Vertex{{0.1f, 0.2f, 0}, normal},
+                                Vertex{{0.9f, -1, 0}, normal}}};
+
+        auto coplanar = QList<Polygon>{};
+        auto front = QList<Polygon>{};
+        auto back = QList<Polygon>{};
+
+        a.split(plane, &coplanar, &coplanar, &front, &back);
+        b.split(plane, &coplanar, &coplanar, &front, &back);
+
+        QCOMPARE(front.size(), 2);
+        QCOMPARE(back.size(), 2);
+
+        // Both splits must create the very same vertex on the shared edge.
+        const auto welded = IndexedGeometry{Geometry{front + back}};
+        QCOMPARE(welded.vertices().size(), 7);
+    }
+
+    void testRobustPrecision()
+    {
+        const auto plane = Plane{{1, 0, 0}, 10000};
+        const auto normal = QVector3D{1, 0, 0};
+        const auto below = std::nextafter(10000.0f, 0.0f);
+        const auto above = std::nextafter(10000.0f, 20000.0f);
+
+        // A polygon that lies on the plane, but its coordinates are off by rounding errors.
+        const auto polygon = Polygon{{Vertex{{below, 0, 0}, normal}, Vertex{{10000, 1, 0}, normal},
+                                      Vertex{{above, 1, 1}, normal}, Vertex{{10000, 0, 1}, normal}}};
+
+        auto coplanar = QList<Polygon>{};
+        auto front = QList<Polygon>{};
+        auto back = QList<Polygon>{};
+
+        polygon.split(plane, &coplanar, &coplanar, &front, &back);
+
+        QCOMPARE(coplanar.size(), 0);
+        QCOMPARE(front.size(), 1);
+        QCOMPARE(back.size(), 1);
+
+        coplanar.clear();
+        front.clear();
+        back.clear();
+
+        polygon.split(plane, &coplanar, &coplanar, &front, &back, 1e-5f, Precision::Robust);
+
+        QCOMPARE(coplanar.size(), 1);
+        QCOMPARE(front.size(), 0);
+        QCOMPARE(back.size(), 0);
+
+        // Vertices which clearly are apart from the plane must still be classified.
+        const auto spanning = Polygon{{Vertex{{9999, 0, 0}, normal}, Vertex{{10001, 1, 0}, normal},
+                                       Vertex{{10001, 0, 1}, normal}}};
+
+        spanning.split(plane, &coplanar, &coplanar, &front, &back, 1e-5f, Precision::Robust);
+
+        QCOMPARE(front.size(), 1);
+        QCOMPARE(back.size(), 1);
+
+        // The precision is kept by the nodes of a BSP tree.
+        const auto tree = std::get<Node>(Node::fromPolygons(cube().polygons(),
+                                                            Options{.precision = Precision::Robust}));
+
+        QCOMPARE(tree.precision(), Precision::Robust);
+        QVERIFY(tree.back());
+        QCOMPARE(tree.back()->precision(), Precision::Robust);
+        QCOMPARE(FlatTree{tree}.precision(), Precision::Robust);
+    }
+
+    void testTolerance()
+    {
+        // The side faces of these cubes almost line up, but miss each other by a rounding error.
+        const auto a = cube({}, 1);
+        const auto b = cube({0.00005f, 0.00005f, 1}, 1);
+
+        const auto strict = merge(a, b);
+        const auto tolerant = merge(a, b, Options{.tolerance = 1e-4f});
+
+        QCOMPARE(strict.error(), Error::NoError);
+        QCOMPARE(tolerant.error(), Error::NoError);
+        QVERIFY(tolerant.polygons().size() < strict.polygons().size());
+
+        // Relative tolerances are resolved against the bounding box of the polygons.
+        const auto relative = Options{.tolerance = 1e-3f, .toleranceMode = ToleranceMode::Relative};
+        const auto slab = cube({}, {300, 400, 0.1f});
+        const auto tree = std::get<Node>(Node::fromPolygons(slab.polygons(), relative));
+        const auto diagonal = slab.boundingBox().maximum() - slab.boundingBox().minimum();
+
+        QCOMPARE(tree.tolerance(), 1e-3f * diagonal.length());
+        QVERIFY(tree.back());
+        QCOMPARE(tree.back()->tolerance(), tree.tolerance());
+        QCOMPARE(FlatTree{tree}.tolerance(), tree.tolerance());
+
+        const auto relativeMerge = merge(a, b, Options{.tolerance = 1e-4f, .toleranceMode = ToleranceMode::Relative});
+        QCOMPARE(relativeMerge.polygons().size(), tolerant.polygons().size());
+    }
+
+    void testIncrementalOperation_data()
+    {
+        QTest::addColumn<Operation>("operation");
+
+        QTest::newRow("merge") << Operation::Merge;
+        QTest::newRow("subtract") << Operation::Subtract;
+        QTest::newRow("intersect") << Operation::Intersect;
+    }
+
+    void testIncrementalOperation()
+    {
+        const QFETCH(Operation, operation);
+
+        const auto housing = sphere({}, 4, 32, 16);
+        const auto tool = cylinder({0, 4, 0}, {0, 2, 0}, 0.5f);
+        const auto movedTool = cylinder({1, 4, 0}, {1, 2, 0}, 0.5f);
+        const auto distantTool = cylinder({20, 4, 0}, {20, 2, 0}, 0.5f);
+
+        auto incremental = IncrementalOperation{operation, housing, tool};
+        QCOMPARE(incremental.result().error(), Error::NoError);
+
+        // Updates must give exactly the same result as computing from scratch.
+        incremental.setRhs(movedTool);
+        QCOMPARE(incremental.result().polygons(),
+                 IncrementalOperation(operation, housing, movedTool).result().polygons());
+        QCOMPARE(incremental.result().polygons(),
+                 IncrementalOperation(operation, housing, movedTool,
+                                      Options{.parallel = true}).result().polygons());
+
+        incremental.setRhs(distantTool);
+        QCOMPARE(incremental.result().polygons(),
+                 IncrementalOperation(operation, housing, distantTool).result().polygons());
+
+        incremental.setLhs(cube({}, 4));
+        QCOMPARE(incremental.result().polygons(),
+                 IncrementalOperation(operation, cube({}, 4), distantTool).result().polygons());
+
+        // The results match the regular operators.
+        const auto options = Options{.overlapCulling = true};
+        incremental.setLhs(housing);
+        incremental.setRhs(movedTool);
+
+        switch (operation) {
+        case Operation::Merge:
+            QCOMPARE(volume(incremental.result()), volume(merge(housing, movedTool, options)));
+            break;
+        case Operation::Subtract:
+            QCOMPARE(volume(incremental.result()), volume(subtract(housing, movedTool, options)));
+            break;
+        case Operation::Intersect:
+            QCOMPARE(volume(incremental.result()), volume(intersect(housing, movedTool, options)));
+            break;
+        }
+
+        // Inversed operands are unbounded, so that no polygon is distant from them.
+        const auto inverse = distantTool.inversed();
+        const auto expected = (operation == Operation::Merge ? merge(housing, inverse)
+                               : operation == Operation::Subtract ? subtract(housing, inverse)
+                               : intersect(housing, inverse));
+
+        incremental.setRhs(inverse);
+        QCOMPARE(volume(incremental.result()), volume(expected));
+
+        // Errors of operands are reported, and the operation recovers from them.
+        incremental.setRhs(Geometry{Error::NotSupportedError});
+        QCOMPARE(incremental.result().error(), Error::NotSupportedError);
+
+        incremental.setRhs(movedTool);
+        QCOMPARE(incremental.result().error(), Error::NoError);
+        QCOMPARE(incremental.result().polygons(),
+                 IncrementalOperation(operation, housing, movedTool).result().polygons());
+    }
+
     void testNodeConstruct()
     {
         const auto expectedNormal = QVector3D{-1, 0, 0};
@@ -152,6 +844,150 @@ private slots:
         QCOMPARE(plane.w(), 1);
     }
 
+    void testNodeDeepTree()
+    {
+        constexpr auto depth = 10000;
+
+        auto polygons = QList<Polygon>{};
+        polygons.reserve(depth);
+
+        for (auto i = 0; i < depth; ++i) {
+            const auto x = static_cast<float>(i);
+            polygons.append(Polygon{{Vertex{{x, 0, 0}, {1, 0, 0}},
+                                     Vertex{{x, 1, 0}, {1, 0, 0}},
+                                     Vertex{{x, 1, 1}, {1, 0, 0}},
+                                     Vertex{{x, 0, 1}, {1, 0, 0}}}});
+        }
+
+        auto maybeNode = Node::fromPolygons(polygons);
+
+        if (std::holds_alternative<Error>(maybeNode))
+            QCOMPARE(std::get<Error>(maybeNode), Error::NoError);
+
+        QVERIFY(std::holds_alternative<Node>(maybeNode));
+        auto &node = std::get<Node>(maybeNode);
+
+        QCOMPARE(node.allPolygons().count(), depth);
+        QCOMPARE(node.clipPolygons(polygons).count(), 1); // only the last one is in front of all planes
+
+        node.invert();
+        QCOMPARE(node.allPolygons().count(), depth);
+        QCOMPARE(node.allPolygons().constFirst().plane().normal(), QVector3D(-1, 0, 0));
+
+        QTest::ignoreMessage(QtWarningMsg, "Maximum recursion level reached");
+        QCOMPARE(Node{}.build(polygons, depth / 2), Error::RecursionError);
+    }
+
+    void testNodeResource()
+    {
+        auto resource = CountingResource{};
+
+        {
+            auto node = Node{&resource};
+            QCOMPARE(node.build(cube().polygons()), Error::NoError);
+            QCOMPARE(node.allPolygons().count(), 6);
+            QCOMPARE(resource.allocations, 5); // one per child node
+            QCOMPARE(resource.deallocations, 0);
+        }
+
+        QCOMPARE(resource.deallocations, 5);
+    }
+
+    void testNodeArena()
+    {
+        auto resource = CountingResource{};
+        const auto previousResource = std::pmr::set_default_resource(&resource);
+        const auto restoreResource = qScopeGuard([previousResource] {
+            std::pmr::set_default_resource(previousResource);
+        });
+
+        const auto polygons = sphere().polygons();
+
+        // Trees built without arena allocate each child node on its own.
+        auto maybeNode = Node::fromPolygons(polygons);
+        QVERIFY(std::holds_alternative<Node>(maybeNode));
+        const auto nodeCount = FlatTree{std::get<Node>(maybeNode)}.entries().count();
+        QCOMPARE(resource.allocations, nodeCount - 1);
+
+        // Geometries build their tree into one block of an arena, that gets released at once.
+        resource.allocations = resource.deallocations = 0;
+
+        {
+            const auto tree = Geometry{polygons}.tree();
+            QVERIFY(std::holds_alternative<std::shared_ptr<const Node>>(tree));
+            QCOMPARE(std::get<std::shared_ptr<const Node>>(tree)->allPolygons().count(),
+                     std::get<Node>(maybeNode).allPolygons().count());
+            QCOMPARE(resource.allocations, 1);
+            QCOMPARE(resource.deallocations, 0);
+        }
+
+        QCOMPARE(resource.deallocations, 1);
+
+        // So do the trees of CSG operations, and the cached trees of their operands.
+        resource.allocations = resource.deallocations = 0;
+        QVERIFY(!subtract(Geometry{polygons}, Geometry{cube({0.5f, 0.5f, 0.5f}).polygons()}).isEmpty());
+        QVERIFY(resource.allocations > 0);
+        QVERIFY(resource.allocations < nodeCount / 10);
+        QCOMPARE(resource.deallocations, resource.allocations);
+    }
+
+    void testFlatTree()
+    {
+        const auto maybeNode = Node::fromPolygons(cube().polygons());
+        QVERIFY(std::holds_alternative<Node>(maybeNode));
+        const auto &node = std::get<Node>(maybeNode);
+
+        const auto tree = FlatTree{node};
+        const auto entries = tree.entries();
+
+        QCOMPARE(entries.count(), 6);
+        QCOMPARE(tree.planes().count(), 6);
+        QCOMPARE(tree.planes().constFirst().normal(), node.plane().normal());
+        QCOMPARE(tree.allPolygons(), node.allPolygons());
+
+        for (auto i = 0; i < entries.count(); ++i) {
+            QCOMPARE(make_pair(i, entries[i].front), make_pair(i, FlatTree::NoChild));
+            QCOMPARE(make_pair(i, entries[i].back), make_pair(i, i < 5 ? i + 1u : FlatTree::NoChild));
+            QCOMPARE(make_pair(i, entries[i].firstPolygon), make_pair(i, static_cast<quint32>(i)));
+            QCOMPARE(make_pair(i, entries[i].polygonCount), make_pair(i, 1u));
+        }
+
+        const auto polygons = sphere({0.5f, 0.5f, 0.5f}).polygons();
+        QCOMPARE(tree.clipPolygons(polygons), node.clipPolygons(polygons));
+
+        // Trees for clipping only copy the planes, but clip just the same.
+        const auto clipTree = FlatTree{node, FlatTree::Mode::PlanesOnly};
+        QCOMPARE(clipTree.planes(), tree.planes());
+        QCOMPARE(clipTree.allPolygons().count(), 0);
+        QCOMPARE(clipTree.clipPolygons(polygons), node.clipPolygons(polygons));
+
+        QVERIFY(FlatTree{}.isEmpty());
+        QCOMPARE(FlatTree{}.clipPolygons(polygons), polygons);
+
+        // A degenerate polygon has no plane, and ends up in a node without a plane.
+        // Such nodes must keep clipped polygons, just like Node::clipPolygons() does.
+        const auto normal = QVector3D{1, 0, 0};
+        const auto degenerate = Polygon{{Vertex{{2, 0, 0}, normal}, Vertex{{2, 0.1f, 0}, normal},
+                                         Vertex{{2, 0.2f, 0}, normal}}};
+        QVERIFY(degenerate.plane().isNull());
+
+        const auto maybeDegenerateNode = Node::fromPolygons(cube().polygons() + QList{degenerate});
+        QVERIFY(std::holds_alternative<Node>(maybeDegenerateNode));
+        const auto &degenerateNode = std::get<Node>(maybeDegenerateNode);
+
+        const auto degenerateTree = FlatTree{degenerateNode};
+        QCOMPARE(degenerateTree.allPolygons(), degenerateNode.allPolygons());
+        QCOMPARE(degenerateTree.clipPolygons(polygons), degenerateNode.clipPolygons(polygons));
+
+        // A tree of degenerate polygons only has a root without plane.
+        const auto maybeDegenerateRoot = Node::fromPolygons({degenerate});
+        QVERIFY(std::holds_alternative<Node>(maybeDegenerateRoot));
+        const auto &degenerateRoot = std::get<Node>(maybeDegenerateRoot);
+
+        QCOMPARE(FlatTree{degenerateRoot}.allPolygons(), degenerateRoot.allPolygons());
+        QCOMPARE(FlatTree{degenerateRoot}.clipPolygons(polygons), polygons);
+    }
+
     void testNodeInvert()
     {
         const auto expectedNormal = QVector3D{1, 0, 0};
@@ -161,12 +997,12 @@ private slots:
             QCOMPARE(std::get<Error>(maybeNode), Error::NoError);
 
         QVERIFY(std::holds_alternative<Node>(maybeNode));
-        const auto node = std::get<Node>(maybeNode);
+        const auto node = std::get<Node>(maybeNode).inverted();
 
         {
             auto depth = 0;
 
-            for (auto subNode = &node; subNode; subNode = subNode->back().get(), ++depth) {
+            for (auto subNode = std::make_shared<const Node>(node); subNode; subNode = subNode->front(), ++depth) {
                 QCOMPARE(make_pair(depth, static_cast<int>(subNode->polygons().count())),
                          make_pair(depth, 1));
                 QCOMPARE(make_pair(depth, static_cast<int>(subNode->polygons().constFirst().vertices().count())),
@@ -185,6 +1021,10 @@ private slots:
         QVERIFY(!plane.isNull());
         QCOMPARE(plane.normal(), expectedNormal);
         QCOMPARE(plane.w(), -1);
+
+        QCOMPARE(node.inverted().plane().normal(), -expectedNormal);
+        QCOMPARE(node.inverted().allPolygons(), std::get<Node>(maybeNode).allPolygons());
+        QCOMPARE(std::get<Node>(maybeNode).plane().normal(), -expectedNormal);
     }
 
     void testSplitWithAllInFront()
@@ -266,6 +1106,202 @@ private slots:
             QVERIFY2(v.position().x() >= 0, "All front vertices must have x >= 0");
         for (const auto &v: back.constFirst().vertices())
             QVERIFY2(v.position().x() <= 0, "All back vertices must have x <= 0");
+
+        QCOMPARE(front.constFirst().plane(), poly.plane());
+        QCOMPARE(back.constFirst().plane(), poly.plane());
+    }
+
+    void testSplitAll()
+    {
+        const auto polygons = sphere({}, 1, 32, 16).polygons();
+        const auto planes = {
+            Plane::fromPoints({0, 0, 0}, {0, 1, 0}, {0, 0, 1}),
+            Plane{QVector3D{1, 2, -2}.normalized(), 0.25f},
+            polygons[37].plane(),
+        };
+
+        for (const auto &plane: planes) {
+            for (const auto precision: {Precision::Fast, Precision::Robust}) {
+                auto expectedCpf = QList<Polygon>{};
+                auto expectedCpb = QList<Polygon>{};
+                auto expectedFront = QList<Polygon>{};
+                auto expectedBack = QList<Polygon>{};
+
+                for (const auto &p: polygons) {
+                    p.split(plane, &expectedCpf, &expectedCpb, &expectedFront, &expectedBack,
+                            defaultTolerance(), precision);
+                }
+
+                auto cpf = QList<Polygon>{};
+                auto cpb = QList<Polygon>{};
+                auto front = QList<Polygon>{};
+                auto back = QList<Polygon>{};
+
+                Polygon::splitAll(polygons, plane, &cpf, &cpb, &front, &back,
+                                  defaultTolerance(), precision);
+
+                QCOMPARE(cpf, expectedCpf);
+                QCOMPARE(cpb, expectedCpb);
+                QCOMPARE(front, expectedFront);
+                QCOMPARE(back, expectedBack);
+            }
+        }
+    }
+
+    void testClassifyVertices()
+    {
+        const auto plane = Plane{QVector3D{1, 2, -2}.normalized(), 0.5f};
+        const auto epsilon = 1e-5f;
+
+        // Vertices on both sides of the plane, and some within epsilon of it.
+        auto vertices = VertexList{};
+
+        for (auto i = 0; i < 37; ++i) {
+            const auto position = QVector3D{std::sin(i * 1.3f), std::cos(i * 0.7f), std::sin(i * 2.9f)};
+            const auto distance = dotProduct(plane.normal(), position) - plane.w();
+            const auto onPlane = position - plane.normal() * distance;
+            vertices.append(Vertex{i % 5 ? position : onPlane, {}});
+        }
+
+        for (auto count = qsizetype{1}; count <= vertices.size(); ++count) {
+            auto expectedTypes = QVector<Simd::VertexType>(count);
+            const auto expectedType = Simd::classifyVertices(Simd::InstructionSet::Scalar, plane,
+                                                             vertices.constData(), count, epsilon,
+                                                             expectedTypes.data());
+
+            // The vertices also get classified through pointers, in reverse order.
+            auto pointers = QVector<const Vertex *>{};
+            auto reversedTypes = QVector<Simd::VertexType>{};
+
+            for (auto i = count - 1; i >= 0; --i) {
+                pointers.append(&vertices[i]);
+                reversedTypes.append(expectedTypes[i]);
+            }
+
+            for (const auto instructionSet: {Simd::InstructionSet::Scalar, Simd::InstructionSet::SSE2,
+                                             Simd::InstructionSet::AVX2}) {
+                if (!Simd::isSupported(instructionSet))
+                    continue;
+
+                auto types = QVector<Simd::VertexType>(count);
+                const auto type = Simd::classifyVertices(instructionSet, plane, vertices.constData(),
+                                                         count, epsilon, types.data());
+
+                QCOMPARE(make_pair(count, type), make_pair(count, expectedType));
+                QCOMPARE(types, expectedTypes);
+
+                const auto typeByPointer = Simd::classifyVertices(instructionSet, plane, pointers.constData(),
+                                                                  count, epsilon, types.data());
+
+                QCOMPARE(make_pair(count, typeByPointer), make_pair(count, expectedType));
+                QCOMPARE(types, reversedTypes);
+            }
+        }
+    }
+
+    void benchmarkClassifyVertices_data()
+    {
+        QTest::addColumn<Simd::InstructionSet>("instructionSet");
+        QTest::addColumn<bool>("batched");
+
+        for (const auto &[name, instructionSet]: {std::pair{"Scalar", Simd::InstructionSet::Scalar},
+                                                  std::pair{"SSE2", Simd::InstructionSet::SSE2},
+                                                  std::pair{"AVX2", Simd::InstructionSet::AVX2}}) {
+            QTest::addRow("%s/polygons", name) << instructionSet << false;
+            QTest::addRow("%s/batched", name) << instructionSet << true;
+        }
+    }
+
+    void benchmarkClassifyVertices()
+    {
+        const QFETCH(Simd::InstructionSet, instructionSet);
+        const QFETCH(bool, batched);
+
+        if (!Simd::isSupported(instructionSet))
+            QSKIP("This instruction set is not supported by the current CPU");
+
+        // Triangles and quads, just like most polygons split while building BSP trees.
+        const auto polygons = sphere({}, 1, 64, 32).polygons();
+        const auto plane = Plane{QVector3D{1, 2, -2}.normalized(), 0.25f};
+
+        auto vertexCount = qsizetype{0};
+
+        for (const auto &p: polygons)
+            vertexCount += p.size();
+
+        auto types = QVector<Simd::VertexType>(vertexCount);
+
+        // The batched classification also pays for collecting the vertices of all polygons.
+        QBENCHMARK {
+            if (batched) {
+                auto vertices = QVector<const Vertex *>(vertexCount);
+                auto v = vertices.data();
+
+                for (const auto &p: polygons) {
+                    for (const auto &vertex: p.vertices())
+                        *v++ = &vertex;
+                }
+
+                Simd::classifyVertices(instructionSet, plane, vertices.constData(),
+                                       vertexCount, defaultTolerance(), types.data());
+            } else {
+                auto t = types.data();
+
+                for (const auto &p: polygons) {
+                    Simd::classifyVertices(instructionSet, plane, p.vertices().constData(),
+                                           p.size(), defaultTolerance(), t);
+                    t += p.size();
+                }
+            }
+        }
+    }
+
+    void testTransformVertices()
+    {
+        auto vertices = VertexList{};
+
+        for (auto i = 0; i < 11; ++i) {
+            vertices.append(Vertex{{std::sin(i * 1.3f), std::cos(i * 0.7f), std::sin(i * 2.9f)},
+                                   QVector3D{std::cos(i * 0.3f), 1, std::sin(i * 1.1f)}.normalized()});
+        }
+
+        auto perspective = QMatrix4x4{};
+        perspective(3, 2) = 0.25f;
+
+        const auto matrices = {
+            translation({1, -2, 3}) * rotation(30, {1, 1, 0}) * scale({2, 0.5f, 3}),
+            scale({-1, 1, 1}) * rotation(75, {0, 0, 1}),
+            perspective,
+        };
+
+        for (const auto &matrix: matrices) {
+            const auto normalRotation = findRotation(matrix);
+
+            for (const auto instructionSet: {Simd::InstructionSet::Scalar, Simd::InstructionSet::SSE2,
+                                             Simd::InstructionSet::AVX2}) {
+                if (!Simd::isSupported(instructionSet))
+                    continue;
+
+                auto transformed = VertexList(vertices.size());
+                Simd::transformVertices(instructionSet, matrix, normalRotation, vertices.constData(),
+                                        vertices.size(), transformed.data());
+
+                for (auto i = 0; i < vertices.size(); ++i)
+                    QCOMPARE(transformed[i], vertices[i].transformed(matrix));
+            }
+
+            // Transformed planes must match the planes of the transformed vertices,
+            // also regarding their orientation if the matrix mirrors the geometry.
+            for (const auto &polygon: sphere().transformed(matrix).polygons()) {
+                const auto &transformed = polygon.vertices();
+                const auto expected = Plane::fromPoints(transformed[0].position(),
+                                                        transformed[1].position(),
+                                                        transformed[2].position());
+
+                QVERIFY(qFuzzyCompare(dotProduct(polygon.plane().normal(), expected.normal()), 1.0f));
+                QVERIFY(std::abs(polygon.plane().w() - expected.w()) < 1e-5f);
+            }
+        }
     }
 
     void testVertexTransform_data()
@@ -433,6 +1469,123 @@ private slots:
         QCOMPARE(expectedGeometry.error(), expectedGeometry.error());
         QCOMPARE(parsedGeometry.polygons(), expectedGeometry.polygons());
     }
+
+    void testCompileExpression_data()
+    {
+        QTest::addColumn<QString>("expression");
+        QTest::addColumn<Geometry>("expectedGeometry");
+        QTest::addColumn<QString>("expectedWarning");
+
+        QTest::newRow("union")
+            << "union(cube(), sphere(center=[1,0,0]))"
+            << merge(QList{cube(), sphere({1, 0, 0})})
+            << "";
+        QTest::newRow("difference")
+            << "difference(cube(r=2), sphere(), cylinder(h=6))"
+            << subtract(cube({}, 2), QList{sphere(), cylinder({}, 6)})
+            << "";
+        QTest::newRow("intersection")
+            << "intersection(cube(), sphere(r=1.3))"
+            << intersect(QList{cube(), sphere({}, 1.3f)})
+            << "";
+        QTest::newRow("nested")
+            << "union(difference(cube(), sphere(r=1.2)), intersection(cube(r=0.5), sphere(r=0.6)))"
+            << merge(QList{subtract(cube(), QList{sphere({}, 1.2f)}),
+                           intersect(QList{cube({}, 0.5f), sphere({}, 0.6f)})})
+            << "";
+        QTest::newRow("translate")
+            << "translate(v=[1,2,3], cube())"
+            << cube().transformed(translation({1, 2, 3}))
+            << "";
+        QTest::newRow("rotate")
+            << "rotate(angle=45, axis=[1,0,0], cylinder())"
+            << cylinder().transformed(rotation(45, {1, 0, 0}))
+            << "";
+        QTest::newRow("scale:scalar")
+            << "scale(v=2, sphere())"
+            << sphere().transformed(scale(2.0f))
+            << "";
+        QTest::newRow("scale:vector")
+            << "scale( v = [1, 2, 3] , sphere() )"
+            << sphere().transformed(scale(QVector3D{1, 2, 3}))
+            << "";
+
+        QTest::newRow("error:unknown-operation")
+            << "union(cube(), unknown())"
+            << Geometry{Error::NotSupportedError}
+            << R"*(Unsupported primitive: "unknown")*";
+        QTest::newRow("error:missing-operand")
+            << "translate(v=[1,2,3])"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unexpected number of operands for translate operation)*";
+        QTest::newRow("error:single-difference-operand")
+            << "difference(cube())"
+            << Geometry{Error::FileFormatError}
+            << R"*(difference needs at least two operands)*";
+        QTest::newRow("error:primitive-operand")
+            << "cube(sphere())"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unexpected number of operands for cube primitive)*";
+        QTest::newRow("error:unknown-argument")
+            << "union(r=1, cube())"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unsupported argument "r" for union operation)*";
+        QTest::newRow("error:unexpected-expression")
+            << "union(cube(), 42)"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unexpected expression: "42")*";
+        QTest::newRow("error:trailing-garbage")
+            << "cube() cube()"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unexpected expression: "cube()")*";
+        QTest::newRow("error:unbound-variable")
+            << "cube(r=$size)"
+            << Geometry{Error::FileFormatError}
+            << R"*(Unbound variable "$size")*";
+    }
+
+    void testCompileExpression()
+    {
+        const QFETCH(QString, expression);
+        const QFETCH(Geometry, expectedGeometry);
+        const QFETCH(QString, expectedWarning);
+
+        if (!expectedWarning.isEmpty())
+            QTest::ignoreMessage(QtWarningMsg, qUtf8Printable(expectedWarning));
+
+        const auto geometry = Program::compile(expression).evaluate();
+
+        QCOMPARE(geometry.error(), expectedGeometry.error());
+        QCOMPARE(geometry.polygons(), expectedGeometry.polygons());
+    }
+
+    void testExpressionBindings()
+    {
+        const auto program = compileExpression("difference(cube(r=$size), translate("
+                                               "v=[0,0,$depth], cylinder(r=$radius, h=4)))");
+
+        QCOMPARE(program.error(), Error::NoError);
+        QCOMPARE(program.variables(), (QStringList{"depth", "radius", "size"}));
+
+        for (const auto &[size, depth, radius]: {std::tuple{1.0f, 0.5f, 0.3f},
+                                                 std::tuple{2.0f, 1.0f, 0.7f}}) {
+            const auto bindings = Program::Bindings{{"size", size},
+                                                    {"depth", depth},
+                                                    {"radius", radius}};
+            const auto expectedGeometry = subtract(cube({}, size), QList{
+                cylinder({}, 4, radius).transformed(translation({0, 0, depth}))});
+
+            QCOMPARE(program.evaluate(bindings).polygons(), expectedGeometry.polygons());
+        }
+
+        const auto vectorProgram = compileExpression("cube(center=$center, r=[1,$height,1])");
+
+        QCOMPARE(vectorProgram.evaluate({{"center", QVector3D{1, 2, 3}}, {"height", 2}}).polygons(),
+                 cube({1, 2, 3}, {1, 2, 1}).polygons());
+
+        QTest::ignoreMessage(QtWarningMsg, R"(Unsupported value type for argument "center" of cube primitive)");
+        QCOMPARE(vectorProgram.evaluate({{"center", 1}, {"height", 2}}).error(), Error::FileFormatError);
+    }
 };
 
 } // namespace QtCSG::Tests